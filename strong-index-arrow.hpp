@@ -0,0 +1,1001 @@
+// strong-index-arrow.hpp: reading and writing index-keyed tables as Arrow IPC
+// files, with no dependency on the Arrow libraries.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_ARROW
+#define STRONG_INDEX_ARROW
+
+#include "strong-index-containers.hpp"
+#include "strong-index-nullable.hpp"
+
+#include <algorithm>    // copy, max
+#include <bit>          // endian
+#include <cstddef>      // size_t
+#include <cstdint>      // int32_t, int64_t, uint8_t, uint16_t, uint32_t
+#include <cstring>      // memcpy
+#include <limits>       // numeric_limits
+#include <optional>
+#include <ostream>
+#include <span>
+#include <stdexcept>    // invalid_argument, runtime_error
+#include <string>
+#include <string_view>
+#include <type_traits>  // is_arithmetic_v, is_same_v, is_trivially_copyable_v
+#include <utility>      // move, pair
+#include <vector>
+
+namespace StrongIndex {
+
+static_assert(std::endian::native == std::endian::little,
+              "Arrow buffers are little-endian, and they are handed over "
+              "without conversion.");
+
+// The column types which can be read and written: integers of 8 to 64 bits,
+// 32- and 64-bit floating point, and UTF-8 strings.
+enum class ArrowKind { Int, FloatingPoint, Utf8 };
+
+struct ArrowType {
+    ArrowKind kind;
+    int bitWidth = 0;
+    bool isSigned = false;
+
+    friend bool operator==(const ArrowType&, const ArrowType&) = default;
+};
+
+// The Arrow type of a column of Value.
+template<class Value>
+constexpr ArrowType arrow_type_of() noexcept {
+    if constexpr (std::is_same_v<Value, std::string>) {
+        return {ArrowKind::Utf8, 0, false};
+    } else if constexpr (std::is_floating_point_v<Value>) {
+        static_assert(sizeof(Value) == 4 || sizeof(Value) == 8,
+                      "Only 32- and 64-bit floating point is supported.");
+        return {ArrowKind::FloatingPoint, int(sizeof(Value) * 8), true};
+    } else {
+        static_assert(std::is_integral_v<Value>
+                              && !std::is_same_v<Value, bool>,
+                      "Arrow columns must hold integers, floating point or "
+                      "std::string.");
+        return {ArrowKind::Int, int(sizeof(Value) * 8),
+                std::is_signed_v<Value>};
+    }
+}
+
+// A column's name, type and key-value metadata, as found in the schema.
+struct ArrowField {
+    std::string name;
+    ArrowType type;
+    bool nullable = false;
+    std::vector<std::pair<std::string, std::string>> metadata;
+
+    std::optional<std::string_view> find_metadata(std::string_view key) const {
+        for (const auto& [k, v] : metadata) {
+            if (k == key) return std::string_view(v);
+        }
+        return std::nullopt;
+    }
+};
+
+// The metadata key under which an index column's tag name is kept.
+inline constexpr std::string_view arrowTagKey = "strong_index.tag";
+
+namespace ArrowDetail {
+
+// Just enough of FlatBuffers to write Arrow's metadata. Like the official
+// builder, this fills its buffer from the back, so that everything a table
+// refers to is written before it and ends up after it, where unsigned
+// offsets can reach. An Offset is a distance from the end of the buffer.
+class FlatBuilder {
+  public:
+    using Offset = std::uint32_t;
+
+    template<class S>
+    void push(S value) {
+        prepare(sizeof(S), 0);
+        reserve(sizeof(S));
+        size_ += sizeof(S);
+        std::memcpy(position(), &value, sizeof(S));
+    }
+
+    Offset string(std::string_view text) {
+        prepare(4, text.size() + 1);
+        reserve(text.size() + 1);
+        size_ += text.size() + 1;
+        std::copy(text.begin(), text.end(), position());
+        position()[text.size()] = 0;
+        push(static_cast<std::uint32_t>(text.size()));
+        return static_cast<Offset>(size_);
+    }
+
+    Offset offsets(const std::vector<Offset>& targets) {
+        prepare(4, targets.size() * 4);
+        for (std::size_t i = targets.size(); i-- > 0;) push_offset(targets[i]);
+        push(static_cast<std::uint32_t>(targets.size()));
+        return static_cast<Offset>(size_);
+    }
+
+    // A vector of structs. Every struct Arrow needs here is a run of 8-byte
+    // fields (Block's int32 and the padding after it count as one), so they
+    // are given as longs, fieldsPerStruct at a time.
+    Offset structs(const std::vector<std::int64_t>& fields,
+                   std::size_t fieldsPerStruct) {
+        prepare(4, fields.size() * 8);
+        prepare(8, fields.size() * 8);
+        for (std::size_t i = fields.size(); i-- > 0;) push(fields[i]);
+        push(static_cast<std::uint32_t>(fields.size() / fieldsPerStruct));
+        return static_cast<Offset>(size_);
+    }
+
+    void start_table() {
+        fields_.clear();
+        tableStart_ = size_;
+    }
+
+    template<class S>
+    void add(std::uint16_t field, S value) {
+        push(value);
+        fields_.emplace_back(field, size_);
+    }
+
+    void add_offset(std::uint16_t field, Offset target) {
+        push_offset(target);
+        fields_.emplace_back(field, size_);
+    }
+
+    Offset end_table() {
+        push(std::int32_t(0));
+        const std::size_t table = size_;
+        std::size_t fieldCount = 0;
+        for (const auto& [field, at] : fields_) {
+            fieldCount = std::max<std::size_t>(fieldCount, field + 1);
+        }
+        std::vector<std::uint16_t> vtable(2 + fieldCount, 0);
+        vtable[0] = static_cast<std::uint16_t>(vtable.size() * 2);
+        vtable[1] = static_cast<std::uint16_t>(table - tableStart_);
+        for (const auto& [field, at] : fields_) {
+            vtable[2 + field] = static_cast<std::uint16_t>(table - at);
+        }
+        for (std::size_t i = vtable.size(); i-- > 0;) push(vtable[i]);
+        // The table starts with the signed distance back to its vtable.
+        const auto toVtable = static_cast<std::int32_t>(size_ - table);
+        std::memcpy(buffer_.data() + buffer_.size() - table, &toVtable,
+                    sizeof(toVtable));
+        return static_cast<Offset>(table);
+    }
+
+    // The finished buffer, with root as its root table.
+    std::vector<std::uint8_t> finish(Offset root) {
+        prepare(alignment_, 4);
+        push_offset(root);
+        return std::vector<std::uint8_t>(position(),
+                                         buffer_.data() + buffer_.size());
+    }
+
+  private:
+    std::vector<std::uint8_t> buffer_;
+    std::size_t size_ = 0;
+    std::size_t alignment_ = 1;
+    std::vector<std::pair<std::uint16_t, std::size_t>> fields_;
+    std::size_t tableStart_ = 0;
+
+    std::uint8_t* position() noexcept {
+        return buffer_.data() + buffer_.size() - size_;
+    }
+
+    // Makes room for bytes more in front of what's been written.
+    void reserve(std::size_t bytes) {
+        if (size_ + bytes <= buffer_.size()) return;
+        std::vector<std::uint8_t> bigger(
+                std::max(buffer_.size() * 2, size_ + bytes + 256));
+        std::copy(buffer_.end() - size_, buffer_.end(),
+                  bigger.end() - size_);
+        buffer_ = std::move(bigger);
+    }
+
+    // Pads so that after writing extra more bytes, the buffer ends on a
+    // multiple of alignment from its end.
+    void prepare(std::size_t alignment, std::size_t extra) {
+        alignment_ = std::max(alignment_, alignment);
+        const std::size_t padding = (alignment - (size_ + extra) % alignment)
+                                    % alignment;
+        reserve(padding);
+        for (std::size_t i = 0; i < padding; ++i) {
+            ++size_;
+            *position() = 0;
+        }
+    }
+
+    void push_offset(Offset target) {
+        prepare(4, 0);
+        push(static_cast<std::uint32_t>(size_ + 4 - target));
+    }
+};
+
+inline void malformed(const char* what) {
+    throw std::runtime_error(std::string("Malformed Arrow file: ") + what);
+}
+
+template<class S>
+S load(std::span<const std::uint8_t> bytes, std::size_t position) {
+    if (position > bytes.size() || bytes.size() - position < sizeof(S)) {
+        malformed("read past the end");
+    }
+    S value;
+    std::memcpy(&value, bytes.data() + position, sizeof(S));
+    return value;
+}
+
+// A table inside a FlatBuffer, checked against the buffer's bounds as it's
+// read.
+class FlatTable {
+  public:
+    FlatTable(std::span<const std::uint8_t> bytes, std::size_t position):
+            bytes_(bytes), position_(position) {
+        const std::int64_t vtable = std::int64_t(position)
+                                    - load<std::int32_t>(bytes, position);
+        if (vtable < 0) malformed("bad vtable");
+        vtable_ = static_cast<std::size_t>(vtable);
+        vtableSize_ = load<std::uint16_t>(bytes, vtable_);
+    }
+
+    // The root table of a FlatBuffer.
+    static FlatTable root(std::span<const std::uint8_t> bytes) {
+        return FlatTable(bytes, load<std::uint32_t>(bytes, 0));
+    }
+
+    bool has(std::uint16_t field) const { return at(field) != 0; }
+
+    template<class S>
+    S scalar(std::uint16_t field, S fallback = S()) const {
+        const std::size_t offset = at(field);
+        return offset == 0 ? fallback : load<S>(bytes_, position_ + offset);
+    }
+
+    std::optional<FlatTable> table(std::uint16_t field) const {
+        const std::size_t offset = at(field);
+        if (offset == 0) return std::nullopt;
+        return FlatTable(bytes_, follow(position_ + offset));
+    }
+
+    std::string_view string(std::uint16_t field) const {
+        const std::size_t offset = at(field);
+        if (offset == 0) return {};
+        const std::size_t start = follow(position_ + offset);
+        const std::uint32_t length = load<std::uint32_t>(bytes_, start);
+        if (bytes_.size() - start - 4 < length) malformed("bad string");
+        return std::string_view(
+                reinterpret_cast<const char*>(bytes_.data() + start + 4),
+                length);
+    }
+
+    // The position of a vector's first element, and its length.
+    std::pair<std::size_t, std::size_t> vector(std::uint16_t field,
+                                               std::size_t elementSize) const {
+        const std::size_t offset = at(field);
+        if (offset == 0) return {0, 0};
+        const std::size_t start = follow(position_ + offset);
+        const std::uint32_t length = load<std::uint32_t>(bytes_, start);
+        if ((bytes_.size() - start - 4) / elementSize < length) {
+            malformed("bad vector");
+        }
+        return {start + 4, length};
+    }
+
+    // The i-th table in a vector of tables.
+    std::vector<FlatTable> tables(std::uint16_t field) const {
+        const auto [start, length] = vector(field, 4);
+        std::vector<FlatTable> tables;
+        tables.reserve(length);
+        for (std::size_t i = 0; i < length; ++i) {
+            tables.emplace_back(bytes_, follow(start + i * 4));
+        }
+        return tables;
+    }
+
+    std::span<const std::uint8_t> bytes() const noexcept { return bytes_; }
+
+  private:
+    std::span<const std::uint8_t> bytes_;
+    std::size_t position_;
+    std::size_t vtable_;
+    std::size_t vtableSize_;
+
+    std::size_t at(std::uint16_t field) const {
+        const std::size_t entry = 4 + 2 * std::size_t(field);
+        if (entry + 2 > vtableSize_) return 0;
+        return load<std::uint16_t>(bytes_, vtable_ + entry);
+    }
+
+    std::size_t follow(std::size_t position) const {
+        return position + load<std::uint32_t>(bytes_, position);
+    }
+};
+
+// The enumerations and field numbers used from Arrow's Schema.fbs,
+// Message.fbs and File.fbs.
+inline constexpr std::int16_t metadataV5 = 4;
+inline constexpr std::uint8_t headerSchema = 1;
+inline constexpr std::uint8_t headerRecordBatch = 3;
+inline constexpr std::uint8_t typeInt = 2;
+inline constexpr std::uint8_t typeFloatingPoint = 3;
+inline constexpr std::uint8_t typeUtf8 = 5;
+inline constexpr std::int16_t precisionSingle = 1;
+inline constexpr std::int16_t precisionDouble = 2;
+
+inline constexpr char magic[8] = {'A', 'R', 'R', 'O', 'W', '1', 0, 0};
+inline constexpr std::uint32_t continuation = 0xffffffff;
+
+// Arrow wants every buffer in a message body to start at a multiple of 8.
+constexpr std::size_t padded(std::size_t bytes) noexcept {
+    return (bytes + 7) / 8 * 8;
+}
+
+// A column ready to be written: the field, and its buffers in Arrow's order.
+// The buffers point into the column they came from where its layout already
+// matches Arrow's, and into owned otherwise.
+struct ColumnSource {
+    ArrowField field;
+    std::size_t length = 0;
+    std::size_t nullCount = 0;
+    std::vector<std::span<const std::uint8_t>> buffers;
+    std::vector<std::vector<std::uint8_t>> owned;
+};
+
+template<class Value>
+std::span<const std::uint8_t> as_bytes(std::span<const Value> values) {
+    return std::span<const std::uint8_t>(
+            reinterpret_cast<const std::uint8_t*>(values.data()),
+            values.size_bytes());
+}
+
+// Adds the offsets and character buffers of a Utf8 column to source.
+inline void add_strings(ColumnSource& source,
+                        std::span<const std::string> values) {
+    std::vector<std::uint8_t> offsets((values.size() + 1) * 4);
+    std::size_t total = 0;
+    for (const std::string& value : values) total += value.size();
+    if (total > std::size_t(std::numeric_limits<std::int32_t>::max())) {
+        throw std::invalid_argument("A string column is too long for the "
+                                    "Arrow Utf8 type.");
+    }
+    std::vector<std::uint8_t> characters(total);
+    std::int32_t offset = 0;
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        std::memcpy(offsets.data() + i * 4, &offset, 4);
+        std::copy(values[i].begin(), values[i].end(),
+                  characters.begin() + offset);
+        offset += static_cast<std::int32_t>(values[i].size());
+    }
+    std::memcpy(offsets.data() + values.size() * 4, &offset, 4);
+    source.owned.push_back(std::move(offsets));
+    source.owned.push_back(std::move(characters));
+    source.buffers.emplace_back(source.owned[0]);
+    source.buffers.emplace_back(source.owned[1]);
+}
+
+} // namespace ArrowDetail
+
+// An ArrowWriter writes a table whose rows are numbered by Row as an Arrow
+// IPC file, the format pyarrow.ipc.open_file(), pandas.read_feather() and
+// most analytics tools read. Columns are added by name:
+//
+//     ArrowWriter<OrderRow> writer;
+//     writer.add("price", prices)            // IndexedVector<OrderRow, double>
+//           .add("user", users, "UserId")    // IndexedVector<OrderRow, UserId>
+//           .add("discount", discounts);     // NullableColumn<OrderRow, float>
+//     writer.write(file);
+//
+// A column of strong indices is written as a column of their underlying
+// integers, with the tag name given kept in its field's metadata under
+// arrowTagKey, so that ArrowReader::index_column() can refuse to read a
+// UserId column as OrderIds.
+//
+// The columns are not copied when they are added, and their buffers are
+// written straight to the stream, so the columns must outlive write().
+// Only string columns are converted, to Arrow's offsets-and-characters
+// layout.
+template<class Row>
+class ArrowWriter {
+  public:
+    ArrowWriter() = default;
+
+    // A copy's string buffers would still point into this writer's storage.
+    ArrowWriter(const ArrowWriter&) = delete;
+    ArrowWriter& operator=(const ArrowWriter&) = delete;
+    ArrowWriter(ArrowWriter&&) = default;
+    ArrowWriter& operator=(ArrowWriter&&) = default;
+
+    template<class Value>
+    ArrowWriter& add(std::string name,
+                     const IndexedVector<Row, Value>& column) {
+        ArrowDetail::ColumnSource source = start<Value>(std::move(name),
+                                                        column.size(), false);
+        add_values(source, std::span<const Value>(column.data(),
+                                                  column.size()));
+        columns_.push_back(std::move(source));
+        return *this;
+    }
+
+    template<class Value>
+    ArrowWriter& add(std::string name,
+                     const NullableColumn<Row, Value>& column) {
+        ArrowDetail::ColumnSource source = start<Value>(std::move(name),
+                                                        column.size(), true);
+        source.nullCount = column.null_count();
+        source.buffers[0] = ArrowDetail::as_bytes(column.validity_words());
+        add_values(source, column.values());
+        columns_.push_back(std::move(source));
+        return *this;
+    }
+
+    // Adds a column of strong indices, recording tag as their tag.
+    template<class Index>
+    ArrowWriter& add(std::string name, const IndexedVector<Row, Index>& column,
+                     std::string tag) {
+        using T = typename Index::Underlying;
+        static_assert(sizeof(Index) == sizeof(T)
+                              && std::is_trivially_copyable_v<Index>,
+                      "Index must have the same layout as its underlying "
+                      "type.");
+        ArrowDetail::ColumnSource source = start<T>(std::move(name),
+                                                    column.size(), false);
+        source.field.metadata.emplace_back(arrowTagKey, std::move(tag));
+        source.buffers.emplace_back(
+                reinterpret_cast<const std::uint8_t*>(column.data()),
+                column.size() * sizeof(Index));
+        columns_.push_back(std::move(source));
+        return *this;
+    }
+
+    std::size_t rows() const noexcept {
+        return columns_.empty() ? 0 : columns_.front().length;
+    }
+
+    // Writes the table as one record batch. Throws std::runtime_error if the
+    // stream fails.
+    void write(std::ostream& out) const {
+        using namespace ArrowDetail;
+        std::size_t position = 0;
+        auto emit = [&](const void* data, std::size_t bytes) {
+            out.write(static_cast<const char*>(data),
+                      static_cast<std::streamsize>(bytes));
+            position += bytes;
+        };
+        auto pad = [&](std::size_t bytes) {
+            static constexpr char zeros[8] = {};
+            emit(zeros, padded(bytes) - bytes);
+        };
+        // A message is a continuation marker, the metadata's length, and
+        // the metadata padded to a multiple of 8. Returns the bytes written.
+        auto emit_message = [&](const std::vector<std::uint8_t>& metadata) {
+            const auto length = static_cast<std::int32_t>(
+                    padded(metadata.size()));
+            emit(&continuation, 4);
+            emit(&length, 4);
+            emit(metadata.data(), metadata.size());
+            pad(metadata.size());
+            return std::size_t(8) + std::size_t(length);
+        };
+
+        emit(magic, sizeof(magic));
+        emit_message(schema_message());
+
+        const std::size_t batchOffset = position;
+        std::size_t bodyLength = 0;
+        for (const ColumnSource& column : columns_) {
+            for (std::span<const std::uint8_t> buffer : column.buffers) {
+                bodyLength += padded(buffer.size());
+            }
+        }
+        const std::size_t batchMetadata = emit_message(
+                record_batch_message(bodyLength));
+        for (const ColumnSource& column : columns_) {
+            for (std::span<const std::uint8_t> buffer : column.buffers) {
+                emit(buffer.data(), buffer.size());
+                pad(buffer.size());
+            }
+        }
+
+        const std::int32_t endOfStream[2] = {-1, 0};
+        emit(endOfStream, sizeof(endOfStream));
+
+        const std::vector<std::uint8_t> footer = this->footer(
+                {std::int64_t(batchOffset), std::int64_t(batchMetadata),
+                 std::int64_t(bodyLength)});
+        const auto footerLength = static_cast<std::int32_t>(footer.size());
+        emit(footer.data(), footer.size());
+        emit(&footerLength, 4);
+        emit(magic, 6);
+        if (!out) throw std::runtime_error("Failed to write Arrow file.");
+    }
+
+  private:
+    std::vector<ArrowDetail::ColumnSource> columns_;
+
+    // A column with an empty validity buffer, for the caller to fill in and
+    // add to columns_ once all of its buffers are there, so that a throw
+    // part-way through leaves no half-built column behind.
+    template<class Value>
+    ArrowDetail::ColumnSource start(std::string name, std::size_t length,
+                                    bool nullable) {
+        if (!columns_.empty() && length != rows()) {
+            throw std::invalid_argument("Column " + name + " has "
+                                        + std::to_string(length)
+                                        + " rows, but the table has "
+                                        + std::to_string(rows()) + ".");
+        }
+        ArrowDetail::ColumnSource source;
+        source.field.name = std::move(name);
+        source.field.type = arrow_type_of<Value>();
+        source.field.nullable = nullable;
+        source.length = length;
+        source.buffers.emplace_back();
+        return source;
+    }
+
+    template<class Value>
+    static void add_values(ArrowDetail::ColumnSource& source,
+                           std::span<const Value> values) {
+        if constexpr (std::is_same_v<Value, std::string>) {
+            ArrowDetail::add_strings(source, values);
+        } else {
+            source.buffers.push_back(ArrowDetail::as_bytes(values));
+        }
+    }
+
+    ArrowDetail::FlatBuilder::Offset schema(
+            ArrowDetail::FlatBuilder& builder) const {
+        using namespace ArrowDetail;
+        std::vector<FlatBuilder::Offset> fields;
+        for (const ColumnSource& column : columns_) {
+            const ArrowField& field = column.field;
+            std::vector<FlatBuilder::Offset> metadata;
+            for (const auto& [key, value] : field.metadata) {
+                const FlatBuilder::Offset k = builder.string(key);
+                const FlatBuilder::Offset v = builder.string(value);
+                builder.start_table();
+                builder.add_offset(0, k);
+                builder.add_offset(1, v);
+                metadata.push_back(builder.end_table());
+            }
+            const FlatBuilder::Offset metadataVector
+                    = builder.offsets(metadata);
+            const FlatBuilder::Offset children = builder.offsets({});
+            const FlatBuilder::Offset name = builder.string(field.name);
+
+            builder.start_table();
+            std::uint8_t typeType = typeUtf8;
+            if (field.type.kind == ArrowKind::Int) {
+                typeType = typeInt;
+                builder.add(0, std::int32_t(field.type.bitWidth));
+                builder.add(1, std::uint8_t(field.type.isSigned));
+            } else if (field.type.kind == ArrowKind::FloatingPoint) {
+                typeType = typeFloatingPoint;
+                builder.add(0, field.type.bitWidth == 32 ? precisionSingle
+                                                         : precisionDouble);
+            }
+            const FlatBuilder::Offset type = builder.end_table();
+
+            builder.start_table();
+            builder.add_offset(0, name);
+            builder.add(1, std::uint8_t(field.nullable));
+            builder.add(2, typeType);
+            builder.add_offset(3, type);
+            builder.add_offset(5, children);
+            if (!metadata.empty()) builder.add_offset(6, metadataVector);
+            fields.push_back(builder.end_table());
+        }
+        const FlatBuilder::Offset fieldVector = builder.offsets(fields);
+        builder.start_table();
+        builder.add(0, std::int16_t(0)); // little-endian
+        builder.add_offset(1, fieldVector);
+        return builder.end_table();
+    }
+
+    std::vector<std::uint8_t> schema_message() const {
+        using namespace ArrowDetail;
+        FlatBuilder builder;
+        const FlatBuilder::Offset header = schema(builder);
+        builder.start_table();
+        builder.add(0, metadataV5);
+        builder.add(1, headerSchema);
+        builder.add_offset(2, header);
+        builder.add(3, std::int64_t(0));
+        return builder.finish(builder.end_table());
+    }
+
+    std::vector<std::uint8_t> record_batch_message(
+            std::size_t bodyLength) const {
+        using namespace ArrowDetail;
+        std::vector<std::int64_t> nodes;
+        std::vector<std::int64_t> buffers;
+        std::size_t offset = 0;
+        for (const ColumnSource& column : columns_) {
+            nodes.push_back(std::int64_t(column.length));
+            nodes.push_back(std::int64_t(column.nullCount));
+            for (std::span<const std::uint8_t> buffer : column.buffers) {
+                buffers.push_back(std::int64_t(offset));
+                buffers.push_back(std::int64_t(buffer.size()));
+                offset += padded(buffer.size());
+            }
+        }
+        FlatBuilder builder;
+        const FlatBuilder::Offset nodeVector = builder.structs(nodes, 2);
+        const FlatBuilder::Offset bufferVector = builder.structs(buffers, 2);
+        builder.start_table();
+        builder.add(0, std::int64_t(rows()));
+        builder.add_offset(1, nodeVector);
+        builder.add_offset(2, bufferVector);
+        const FlatBuilder::Offset header = builder.end_table();
+
+        builder.start_table();
+        builder.add(0, metadataV5);
+        builder.add(1, headerRecordBatch);
+        builder.add_offset(2, header);
+        builder.add(3, std::int64_t(bodyLength));
+        return builder.finish(builder.end_table());
+    }
+
+    // block is the record batch's offset, metadata length and body length.
+    std::vector<std::uint8_t> footer(
+            const std::vector<std::int64_t>& block) const {
+        using namespace ArrowDetail;
+        FlatBuilder builder;
+        const FlatBuilder::Offset batches = builder.structs(block, 3);
+        const FlatBuilder::Offset dictionaries = builder.structs({}, 3);
+        const FlatBuilder::Offset schemaTable = schema(builder);
+        builder.start_table();
+        builder.add(0, metadataV5);
+        builder.add_offset(1, schemaTable);
+        builder.add_offset(2, dictionaries);
+        builder.add_offset(3, batches);
+        return builder.finish(builder.end_table());
+    }
+};
+
+// An ArrowReader reads a table from an Arrow IPC file held in memory, such as
+// one written by ArrowWriter or by pyarrow, as long as its columns are all of
+// the types in ArrowKind, without compression or dictionaries.
+//
+// Nothing is copied when the file is opened. values() and validity() return
+// spans straight into the file's bytes, which must stay alive and unchanged
+// for as long as the reader is used, and which must start at a multiple of 8
+// (as anything from operator new or mmap() does) for values() to work.
+// column(), nullable_column() and index_column() copy a column, across all
+// its record batches, into the matching container.
+//
+// A malformed file makes the constructor throw std::runtime_error. Asking for
+// a column which doesn't exist, or as a type it doesn't have, throws
+// std::invalid_argument.
+class ArrowReader {
+  public:
+    explicit ArrowReader(std::span<const std::uint8_t> file): file_(file) {
+        using namespace ArrowDetail;
+        const std::size_t size = file.size();
+        if (size < 18 || std::memcmp(file.data(), magic, 6) != 0
+            || std::memcmp(file.data() + size - 6, magic, 6) != 0) {
+            malformed("no ARROW1 magic");
+        }
+        const auto footerLength = load<std::int32_t>(file, size - 10);
+        if (footerLength < 0 || std::size_t(footerLength) > size - 18) {
+            malformed("bad footer length");
+        }
+        const FlatTable footer = FlatTable::root(
+                file.subspan(size - 10 - footerLength, footerLength));
+        const std::optional<FlatTable> schema = footer.table(1);
+        if (!schema) malformed("no schema");
+        read_schema(*schema);
+
+        const auto [blocks, count] = footer.vector(3, 24);
+        for (std::size_t b = 0; b < count; ++b) {
+            const std::size_t block = blocks + b * 24;
+            read_batch(load<std::int64_t>(footer.bytes(), block),
+                       load<std::int32_t>(footer.bytes(), block + 8),
+                       load<std::int64_t>(footer.bytes(), block + 16));
+        }
+    }
+
+    std::size_t rows() const noexcept {
+        std::size_t total = 0;
+        for (const Batch& batch : batches_) total += batch.length;
+        return total;
+    }
+
+    const std::vector<ArrowField>& fields() const noexcept { return fields_; }
+
+    const ArrowField& field(std::string_view name) const {
+        return fields_[column_of(name)];
+    }
+
+    std::size_t batch_count() const noexcept { return batches_.size(); }
+    std::size_t batch_rows(std::size_t batch) const {
+        return batches_.at(batch).length;
+    }
+
+    std::size_t null_count(std::string_view name) const {
+        const std::size_t column = column_of(name);
+        std::size_t total = 0;
+        for (const Batch& batch : batches_) {
+            total += batch.columns[column].nullCount;
+        }
+        return total;
+    }
+
+    // The values of a numeric column in one record batch, without copying.
+    // Null rows hold whatever the writer put there.
+    template<class Value>
+    std::span<const Value> values(std::string_view name,
+                                  std::size_t batch = 0) const {
+        static_assert(std::is_arithmetic_v<Value>,
+                      "Only numeric columns can be viewed in place.");
+        const std::size_t column = checked<Value>(name);
+        const Chunk& chunk = batches_.at(batch).columns[column];
+        if (reinterpret_cast<std::uintptr_t>(chunk.values.data())
+            % alignof(Value) != 0) {
+            throw std::invalid_argument("Column " + std::string(name)
+                                        + " is not aligned in memory.");
+        }
+        if (chunk.values.size() / sizeof(Value) < chunk.length) {
+            ArrowDetail::malformed("value buffer is too short");
+        }
+        return std::span<const Value>(
+                reinterpret_cast<const Value*>(chunk.values.data()),
+                chunk.length);
+    }
+
+    // The validity bitmap of a column in one record batch, row i in bit
+    // i % 8 of byte i / 8, or an empty span if the batch has no nulls.
+    std::span<const std::uint8_t> validity(std::string_view name,
+                                           std::size_t batch = 0) const {
+        return batches_.at(batch).columns[column_of(name)].validity;
+    }
+
+    // Copies a column with no nulls into an IndexedVector.
+    template<class Row, class Value>
+    IndexedVector<Row, Value> column(std::string_view name) const {
+        if (null_count(name) != 0) {
+            throw std::invalid_argument("Column " + std::string(name)
+                                        + " has nulls.");
+        }
+        IndexedVector<Row, Value> result;
+        result.reserve(rows());
+        for_each<Value>(name, [&](bool, Value value) {
+            result.push_back(std::move(value));
+        });
+        return result;
+    }
+
+    template<class Row, class Value>
+    NullableColumn<Row, Value> nullable_column(std::string_view name) const {
+        NullableColumn<Row, Value> result;
+        result.reserve(rows());
+        for_each<Value>(name, [&](bool valid, Value value) {
+            valid ? result.push_back(std::move(value)) : result.push_null();
+        });
+        return result;
+    }
+
+    // Copies a column of strong indices, which must have been written with
+    // the same tag.
+    template<class Row, class Index>
+    IndexedVector<Row, Index> index_column(std::string_view name,
+                                           std::string_view tag) const {
+        using T = typename Index::Underlying;
+        if (field(name).find_metadata(arrowTagKey) != tag) {
+            throw std::invalid_argument("Column " + std::string(name)
+                                        + " does not hold "
+                                        + std::string(tag) + " indices.");
+        }
+        IndexedVector<Row, Index> result;
+        result.reserve(rows());
+        for (T value : column<Row, T>(name)) result.push_back(Index(value));
+        return result;
+    }
+
+  private:
+    // One column's buffers within one record batch.
+    struct Chunk {
+        std::size_t length = 0;
+        std::size_t nullCount = 0;
+        std::span<const std::uint8_t> validity;
+        std::span<const std::uint8_t> offsets;
+        std::span<const std::uint8_t> values;
+    };
+
+    struct Batch {
+        std::size_t length = 0;
+        std::vector<Chunk> columns;
+    };
+
+    std::span<const std::uint8_t> file_;
+    std::vector<ArrowField> fields_;
+    std::vector<Batch> batches_;
+
+    std::size_t column_of(std::string_view name) const {
+        for (std::size_t i = 0; i < fields_.size(); ++i) {
+            if (fields_[i].name == name) return i;
+        }
+        throw std::invalid_argument("No column named " + std::string(name)
+                                    + ".");
+    }
+
+    template<class Value>
+    std::size_t checked(std::string_view name) const {
+        const std::size_t column = column_of(name);
+        if (!(fields_[column].type == arrow_type_of<Value>())) {
+            throw std::invalid_argument("Column " + std::string(name)
+                                        + " has a different type.");
+        }
+        return column;
+    }
+
+    // Calls function(bool valid, Value) on every row of a column, in order.
+    template<class Value, class Function>
+    void for_each(std::string_view name, Function function) const {
+        const std::size_t column = checked<Value>(name);
+        for (const Batch& batch : batches_) {
+            const Chunk& chunk = batch.columns[column];
+            for (std::size_t i = 0; i < chunk.length; ++i) {
+                const bool valid = chunk.validity.empty()
+                                   || (chunk.validity[i / 8] >> (i % 8)) & 1;
+                if constexpr (std::is_same_v<Value, std::string>) {
+                    const auto first = ArrowDetail::load<std::int32_t>(
+                            chunk.offsets, i * 4);
+                    const auto last = ArrowDetail::load<std::int32_t>(
+                            chunk.offsets, i * 4 + 4);
+                    if (first < 0 || last < first
+                        || std::size_t(last) > chunk.values.size()) {
+                        ArrowDetail::malformed("bad string offsets");
+                    }
+                    function(valid, std::string(
+                            reinterpret_cast<const char*>(chunk.values.data())
+                                    + first,
+                            std::size_t(last - first)));
+                } else {
+                    function(valid, ArrowDetail::load<Value>(
+                            chunk.values, i * sizeof(Value)));
+                }
+            }
+        }
+    }
+
+    void read_schema(const ArrowDetail::FlatTable& schema) {
+        using namespace ArrowDetail;
+        if (schema.scalar<std::int16_t>(0) != 0) {
+            malformed("big-endian files are not supported");
+        }
+        for (const FlatTable& table : schema.tables(1)) {
+            ArrowField& field = fields_.emplace_back();
+            field.name = std::string(table.string(0));
+            field.nullable = table.scalar<std::uint8_t>(1) != 0;
+            const std::optional<FlatTable> type = table.table(3);
+            if (!type || table.has(4) || table.vector(5, 4).second != 0) {
+                malformed("unsupported column type");
+            }
+            switch (table.scalar<std::uint8_t>(2)) {
+              case typeInt:
+                field.type = {ArrowKind::Int, type->scalar<std::int32_t>(0),
+                              type->scalar<std::uint8_t>(1) != 0};
+                if (field.type.bitWidth != 8 && field.type.bitWidth != 16
+                    && field.type.bitWidth != 32
+                    && field.type.bitWidth != 64) {
+                    malformed("bad integer width");
+                }
+                break;
+              case typeFloatingPoint: {
+                const auto precision = type->scalar<std::int16_t>(0);
+                if (precision != precisionSingle
+                    && precision != precisionDouble) {
+                    malformed("unsupported floating point precision");
+                }
+                field.type = {ArrowKind::FloatingPoint,
+                              precision == precisionSingle ? 32 : 64, true};
+                break;
+              }
+              case typeUtf8:
+                field.type = {ArrowKind::Utf8, 0, false};
+                break;
+              default:
+                malformed("unsupported column type");
+            }
+            for (const FlatTable& pair : table.tables(6)) {
+                field.metadata.emplace_back(pair.string(0), pair.string(1));
+            }
+        }
+    }
+
+    void read_batch(std::int64_t offset, std::int32_t metadataLength,
+                    std::int64_t bodyLength) {
+        using namespace ArrowDetail;
+        if (offset < 0 || metadataLength < 8 || bodyLength < 0
+            || std::uint64_t(offset) > file_.size()
+            || file_.size() - std::uint64_t(offset)
+                       < std::uint64_t(metadataLength)
+                         + std::uint64_t(bodyLength)) {
+            malformed("bad record batch block");
+        }
+        // Files from before Arrow 0.15 have no continuation marker.
+        std::size_t start = std::size_t(offset);
+        if (load<std::uint32_t>(file_, start) == continuation) start += 4;
+        const auto length = load<std::int32_t>(file_, start);
+        if (length < 0 || start + 4 + std::size_t(length)
+                                  > std::size_t(offset) + metadataLength) {
+            malformed("bad message length");
+        }
+        const FlatTable message = FlatTable::root(
+                file_.subspan(start + 4, std::size_t(length)));
+        const std::optional<FlatTable> header = message.table(2);
+        if (message.scalar<std::uint8_t>(1) != headerRecordBatch || !header) {
+            malformed("expected a record batch");
+        }
+        if (header->has(3)) malformed("compressed files are not supported");
+        const std::span<const std::uint8_t> body = file_.subspan(
+                std::size_t(offset) + std::size_t(metadataLength),
+                std::size_t(bodyLength));
+
+        Batch& batch = batches_.emplace_back();
+        const auto batchLength = header->scalar<std::int64_t>(0);
+        if (batchLength < 0) malformed("bad record batch length");
+        batch.length = std::size_t(batchLength);
+        const auto [nodes, nodeCount] = header->vector(1, 16);
+        const auto [buffers, bufferCount] = header->vector(2, 16);
+        std::size_t buffersNeeded = 0;
+        for (const ArrowField& field : fields_) {
+            buffersNeeded += field.type.kind == ArrowKind::Utf8 ? 3 : 2;
+        }
+        if (nodeCount != fields_.size() || bufferCount != buffersNeeded) {
+            malformed("record batch doesn't match the schema");
+        }
+
+        const std::span<const std::uint8_t> metadata = message.bytes();
+        std::size_t nextBuffer = 0;
+        auto take_buffer = [&]() {
+            const std::size_t at = buffers + 16 * nextBuffer++;
+            const auto first = load<std::int64_t>(metadata, at);
+            const auto size = load<std::int64_t>(metadata, at + 8);
+            if (first < 0 || size < 0 || std::uint64_t(first) > body.size()
+                || body.size() - std::uint64_t(first)
+                           < std::uint64_t(size)) {
+                malformed("buffer outside the message body");
+            }
+            return body.subspan(std::size_t(first), std::size_t(size));
+        };
+        for (std::size_t c = 0; c < fields_.size(); ++c) {
+            Chunk& chunk = batch.columns.emplace_back();
+            const auto length = load<std::int64_t>(metadata, nodes + 16 * c);
+            const auto nullCount = load<std::int64_t>(metadata,
+                                                      nodes + 16 * c + 8);
+            if (length != batchLength || nullCount < 0
+                || nullCount > length) {
+                malformed("bad column length");
+            }
+            chunk.length = std::size_t(length);
+            chunk.nullCount = std::size_t(nullCount);
+            chunk.validity = take_buffer();
+            if (fields_[c].type.kind == ArrowKind::Utf8) {
+                chunk.offsets = take_buffer();
+                if (chunk.length > 0
+                    && chunk.offsets.size() / 4 < chunk.length + 1) {
+                    malformed("string offsets are too short");
+                }
+            }
+            chunk.values = take_buffer();
+            if (chunk.validity.empty() ? chunk.nullCount != 0
+                                       : chunk.validity.size() * 8
+                                                 < chunk.length) {
+                malformed("validity bitmap is too short");
+            }
+            if (chunk.nullCount == 0) chunk.validity = {};
+            const std::size_t width = fields_[c].type.bitWidth / 8;
+            if (width != 0 && chunk.values.size() / width < chunk.length) {
+                malformed("value buffer is too short");
+            }
+        }
+    }
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_ARROW
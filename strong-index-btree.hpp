@@ -0,0 +1,511 @@
+// strong-index-btree.hpp: a cache-conscious B+tree keyed by indices, for
+// large ordered maps with frequent inserts and range scans.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_BTREE
+#define STRONG_INDEX_BTREE
+
+#include "strong-index.hpp"
+
+#include <algorithm>    // fill, max, min
+#include <array>
+#include <cstddef>      // size_t, ptrdiff_t
+#include <iterator>     // forward_iterator_tag
+#include <limits>       // numeric_limits
+#include <optional>
+#include <stdexcept>    // invalid_argument
+#include <type_traits>  // conditional
+#include <utility>      // exchange, move, pair
+#include <vector>
+
+namespace StrongIndex {
+
+// A BPlusTree<Index, Value> is an ordered map with all of its entries in
+// leaves that are linked together, so a range scan is a walk along a list of
+// dense arrays. Each node is roughly NodeBytes in size (512 by default, i.e.
+// eight cache lines), which can be raised towards the page size for larger
+// trees.
+//
+// Keys are stored as their underlying integers in fixed-size arrays, with the
+// unused slots filled with the largest possible key. Searching a node then
+// just counts the keys less than the one being looked for across the whole
+// array, a loop with no branches and a fixed trip count which the compiler
+// turns into SIMD comparisons.
+//
+// Erasing never merges nodes, so a tree which shrinks a lot should be rebuilt
+// with bulk_load(). Value must be default constructible.
+template<class Index, class Value, std::size_t NodeBytes = 512>
+class BPlusTree {
+  private:
+    using T = typename Index::Underlying;
+
+  public:
+    static constexpr std::size_t leafCapacity = std::max<std::size_t>(
+            4, NodeBytes / (sizeof(T) + sizeof(Value)));
+    static constexpr std::size_t innerCapacity = std::max<std::size_t>(
+            4, NodeBytes / (sizeof(T) + sizeof(void*)));
+
+  private:
+    static constexpr T padding = std::numeric_limits<T>::max();
+
+    struct Node {
+        explicit Node(bool isLeaf) noexcept: leaf(isLeaf) {}
+        bool leaf;
+        std::size_t count = 0;
+    };
+
+    struct Leaf : Node {
+        Leaf() noexcept: Node(true) { keys.fill(padding); }
+        std::array<T, leafCapacity> keys;
+        std::array<Value, leafCapacity> values{};
+        Leaf* next = nullptr;
+    };
+
+    // Key i is the smallest key in child i+1.
+    struct Inner : Node {
+        Inner() noexcept: Node(false) { keys.fill(padding); }
+        std::array<T, innerCapacity> keys;
+        std::array<Node*, innerCapacity + 1> children{};
+    };
+
+    template<bool Const>
+    class Iterator {
+        using LeafPointer = std::conditional_t<Const, const Leaf*, Leaf*>;
+        using ValueReference = std::conditional_t<Const, const Value&, Value&>;
+
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<Index, ValueReference>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+
+        Iterator() noexcept = default;
+
+        // Skips past the ends of leaves, so equal positions compare equal.
+        Iterator(LeafPointer leaf, std::size_t position) noexcept:
+                leaf_(leaf), position_(position) {
+            normalize();
+        }
+
+        operator Iterator<true>() const noexcept {
+            return Iterator<true>(leaf_, position_);
+        }
+
+        value_type operator*() const noexcept {
+            return value_type(Index(leaf_->keys[position_]),
+                              leaf_->values[position_]);
+        }
+
+        Index key() const noexcept { return Index(leaf_->keys[position_]); }
+        ValueReference value() const noexcept {
+            return leaf_->values[position_];
+        }
+
+        Iterator& operator++() noexcept {
+            ++position_;
+            normalize();
+            return *this;
+        }
+
+        Iterator operator++(int) noexcept {
+            Iterator oldValue(*this);
+            ++*this;
+            return oldValue;
+        }
+
+        friend bool operator==(const Iterator& a, const Iterator& b) noexcept {
+            return a.leaf_ == b.leaf_ && a.position_ == b.position_;
+        }
+
+        friend bool operator!=(const Iterator& a, const Iterator& b) noexcept {
+            return !(a == b);
+        }
+
+      private:
+        LeafPointer leaf_ = nullptr;
+        std::size_t position_ = 0;
+
+        void normalize() noexcept {
+            while (leaf_ != nullptr && position_ == leaf_->count) {
+                leaf_ = leaf_->next;
+                position_ = 0;
+            }
+        }
+    };
+
+  public:
+    using iterator = Iterator<false>;
+    using const_iterator = Iterator<true>;
+
+    // A pair of iterators which can be used in a range-based for loop.
+    template<class It>
+    struct Range {
+        It first;
+        It last;
+        It begin() const noexcept { return first; }
+        It end() const noexcept { return last; }
+    };
+
+    // A lookup which walks down the tree one node per step(), so that many
+    // lookups can be interleaved, each prefetching the node it will read
+    // next while the others run (see strong-index-interleave.hpp).
+    class Cursor {
+      public:
+        // The node the next step() will read, about NodeBytes long, or
+        // nullptr once the lookup is finished.
+        const void* next() const noexcept { return node_; }
+
+        void step() noexcept {
+            if (!node_->leaf) {
+                auto inner = static_cast<const Inner*>(node_);
+                node_ = inner->children[child_for(inner, key_)];
+                return;
+            }
+            auto leaf = static_cast<const Leaf*>(node_);
+            const std::size_t position = search(leaf->keys, leaf->count, key_);
+            if (position < leaf->count && leaf->keys[position] == key_) {
+                result_ = &leaf->values[position];
+            }
+            node_ = nullptr;
+        }
+
+        // The value found, or nullptr if there wasn't one.
+        const Value* result() const noexcept { return result_; }
+
+      private:
+        friend class BPlusTree;
+
+        Cursor(const Node* root, T key) noexcept: node_(root), key_(key) {
+        }
+
+        const Node* node_;
+        T key_;
+        const Value* result_ = nullptr;
+    };
+
+    BPlusTree() = default;
+
+    BPlusTree(const BPlusTree&) = delete;
+    BPlusTree& operator=(const BPlusTree&) = delete;
+
+    BPlusTree(BPlusTree&& other) noexcept:
+            root_(std::exchange(other.root_, nullptr)),
+            size_(std::exchange(other.size_, 0)) {
+    }
+
+    BPlusTree& operator=(BPlusTree&& other) noexcept {
+        if (this != &other) {
+            clear();
+            root_ = std::exchange(other.root_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+        }
+        return *this;
+    }
+
+    ~BPlusTree() {
+        clear();
+    }
+
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    void clear() noexcept {
+        destroy(root_);
+        root_ = nullptr;
+        size_ = 0;
+    }
+
+    // Inserts or overwrites an entry. Returns true if the key is new.
+    bool insert_or_assign(Index index, Value value) {
+        const T key = static_cast<T>(index);
+        if (root_ == nullptr) root_ = new Leaf();
+        bool inserted = false;
+        std::optional<Split> split = insert_into(root_, key, value, inserted);
+        if (split) {
+            Inner* root = new Inner();
+            root->keys[0] = split->separator;
+            root->children[0] = root_;
+            root->children[1] = split->right;
+            root->count = 1;
+            root_ = root;
+        }
+        size_ += inserted;
+        return inserted;
+    }
+
+    // Removes an entry. Returns true if it was there.
+    bool erase(Index index) noexcept {
+        const T key = static_cast<T>(index);
+        Leaf* leaf = find_leaf(key);
+        if (leaf == nullptr) return false;
+        const std::size_t position = search(leaf->keys, leaf->count, key);
+        if (position == leaf->count || leaf->keys[position] != key) {
+            return false;
+        }
+        for (std::size_t i = position; i + 1 < leaf->count; ++i) {
+            leaf->keys[i] = leaf->keys[i + 1];
+            leaf->values[i] = std::move(leaf->values[i + 1]);
+        }
+        --leaf->count;
+        leaf->keys[leaf->count] = padding;
+        leaf->values[leaf->count] = Value();
+        --size_;
+        return true;
+    }
+
+    Value* find(Index index) noexcept {
+        const T key = static_cast<T>(index);
+        Leaf* leaf = find_leaf(key);
+        if (leaf == nullptr) return nullptr;
+        const std::size_t position = search(leaf->keys, leaf->count, key);
+        if (position == leaf->count || leaf->keys[position] != key) {
+            return nullptr;
+        }
+        return &leaf->values[position];
+    }
+
+    const Value* find(Index index) const noexcept {
+        return const_cast<BPlusTree*>(this)->find(index);
+    }
+
+    Cursor cursor(Index index) const noexcept {
+        return Cursor(root_, static_cast<T>(index));
+    }
+
+    // The first entry whose key is not less than index.
+    iterator lower_bound(Index index) noexcept {
+        const T key = static_cast<T>(index);
+        Leaf* leaf = find_leaf(key);
+        if (leaf == nullptr) return end();
+        return iterator(leaf, search(leaf->keys, leaf->count, key));
+    }
+
+    const_iterator lower_bound(Index index) const noexcept {
+        return const_cast<BPlusTree*>(this)->lower_bound(index);
+    }
+
+    // The entries with keys in [first, last), in order.
+    Range<iterator> range(Index first, Index last) noexcept {
+        return {lower_bound(first), lower_bound(last)};
+    }
+
+    Range<const_iterator> range(Index first, Index last) const noexcept {
+        return {lower_bound(first), lower_bound(last)};
+    }
+
+    iterator begin() noexcept { return iterator(leftmost_leaf(), 0); }
+    iterator end() noexcept { return iterator(); }
+    const_iterator begin() const noexcept {
+        return const_cast<BPlusTree*>(this)->begin();
+    }
+    const_iterator end() const noexcept { return const_iterator(); }
+
+    // Replaces the contents of the tree with entries which must already be
+    // sorted by strictly increasing key, building the tree bottom-up with
+    // full nodes. Throws std::invalid_argument if the keys aren't sorted.
+    void bulk_load(std::vector<std::pair<Index, Value>> entries) {
+        for (std::size_t i = 1; i < entries.size(); ++i) {
+            if (!(static_cast<T>(entries[i - 1].first)
+                  < static_cast<T>(entries[i].first))) {
+                throw std::invalid_argument("bulk_load() needs strictly "
+                                            "increasing keys.");
+            }
+        }
+        clear();
+        if (entries.empty()) return;
+
+        // Each level is a list of nodes along with the smallest key in each.
+        std::vector<std::pair<T, Node*>> level;
+        Leaf* previous = nullptr;
+        for (std::size_t i = 0; i < entries.size(); i += leafCapacity) {
+            Leaf* leaf = new Leaf();
+            const std::size_t end = std::min(entries.size(), i + leafCapacity);
+            for (std::size_t j = i; j < end; ++j) {
+                leaf->keys[j - i] = static_cast<T>(entries[j].first);
+                leaf->values[j - i] = std::move(entries[j].second);
+            }
+            leaf->count = end - i;
+            if (previous != nullptr) previous->next = leaf;
+            previous = leaf;
+            level.emplace_back(leaf->keys[0], leaf);
+        }
+
+        while (level.size() > 1) {
+            std::vector<std::pair<T, Node*>> parents;
+            for (std::size_t i = 0; i < level.size(); i += innerCapacity + 1) {
+                Inner* inner = new Inner();
+                const std::size_t end = std::min(level.size(),
+                                                 i + innerCapacity + 1);
+                for (std::size_t j = i; j < end; ++j) {
+                    inner->children[j - i] = level[j].second;
+                    if (j > i) inner->keys[j - i - 1] = level[j].first;
+                }
+                inner->count = end - i - 1;
+                parents.emplace_back(level[i].first, inner);
+            }
+            level = std::move(parents);
+        }
+        root_ = level.front().second;
+        size_ = entries.size();
+    }
+
+  private:
+    Node* root_ = nullptr;
+    std::size_t size_ = 0;
+
+    struct Split {
+        T separator;
+        Node* right;
+    };
+
+    // The number of keys less than key, i.e. the position key would go at.
+    template<std::size_t N>
+    static std::size_t search(const std::array<T, N>& keys, std::size_t count,
+                              T key) noexcept {
+        std::size_t less = 0;
+        for (std::size_t i = 0; i < N; ++i) less += keys[i] < key;
+        return std::min(less, count);
+    }
+
+    // The child of an inner node which can contain key.
+    static std::size_t child_for(const Inner* inner, T key) noexcept {
+        std::size_t notGreater = 0;
+        for (std::size_t i = 0; i < innerCapacity; ++i) {
+            notGreater += inner->keys[i] <= key;
+        }
+        return std::min(notGreater, inner->count);
+    }
+
+    Leaf* find_leaf(T key) const noexcept {
+        Node* node = root_;
+        if (node == nullptr) return nullptr;
+        while (!node->leaf) {
+            auto inner = static_cast<Inner*>(node);
+            node = inner->children[child_for(inner, key)];
+        }
+        return static_cast<Leaf*>(node);
+    }
+
+    Leaf* leftmost_leaf() const noexcept {
+        Node* node = root_;
+        if (node == nullptr) return nullptr;
+        while (!node->leaf) node = static_cast<Inner*>(node)->children[0];
+        return static_cast<Leaf*>(node);
+    }
+
+    std::optional<Split> insert_into(Node* node, T key, Value& value,
+                                     bool& inserted) {
+        if (node->leaf) return insert_into_leaf(static_cast<Leaf*>(node), key,
+                                                value, inserted);
+
+        auto inner = static_cast<Inner*>(node);
+        const std::size_t child = child_for(inner, key);
+        std::optional<Split> split = insert_into(inner->children[child], key,
+                                                 value, inserted);
+        if (!split) return std::nullopt;
+
+        if (inner->count < innerCapacity) {
+            for (std::size_t i = inner->count; i > child; --i) {
+                inner->keys[i] = inner->keys[i - 1];
+                inner->children[i + 1] = inner->children[i];
+            }
+            inner->keys[child] = split->separator;
+            inner->children[child + 1] = split->right;
+            ++inner->count;
+            return std::nullopt;
+        }
+
+        // Lay out all the keys and children including the new ones, then
+        // hand the upper half to a new node and push the middle key up.
+        std::array<T, innerCapacity + 1> keys;
+        std::array<Node*, innerCapacity + 2> children;
+        for (std::size_t i = 0, j = 0; i <= innerCapacity; ++i) {
+            keys[i] = i == child ? split->separator : inner->keys[j++];
+        }
+        for (std::size_t i = 0, j = 0; i <= innerCapacity + 1; ++i) {
+            children[i] = i == child + 1 ? split->right : inner->children[j++];
+        }
+
+        const std::size_t leftCount = (innerCapacity + 1) / 2;
+        Inner* right = new Inner();
+        inner->keys.fill(padding);
+        inner->children.fill(nullptr);
+        for (std::size_t i = 0; i < leftCount; ++i) {
+            inner->keys[i] = keys[i];
+            inner->children[i] = children[i];
+        }
+        inner->children[leftCount] = children[leftCount];
+        inner->count = leftCount;
+        for (std::size_t i = leftCount + 1; i <= innerCapacity; ++i) {
+            right->keys[i - leftCount - 1] = keys[i];
+            right->children[i - leftCount - 1] = children[i];
+        }
+        right->children[innerCapacity - leftCount]
+                = children[innerCapacity + 1];
+        right->count = innerCapacity - leftCount;
+        return Split{keys[leftCount], right};
+    }
+
+    std::optional<Split> insert_into_leaf(Leaf* leaf, T key, Value& value,
+                                          bool& inserted) {
+        const std::size_t position = search(leaf->keys, leaf->count, key);
+        if (position < leaf->count && leaf->keys[position] == key) {
+            leaf->values[position] = std::move(value);
+            inserted = false;
+            return std::nullopt;
+        }
+        inserted = true;
+
+        Leaf* target = leaf;
+        std::size_t targetPosition = position;
+        std::optional<Split> split;
+        if (leaf->count == leafCapacity) {
+            const std::size_t leftCount = (leafCapacity + 1) / 2;
+            Leaf* right = new Leaf();
+            for (std::size_t i = leftCount; i < leafCapacity; ++i) {
+                right->keys[i - leftCount] = leaf->keys[i];
+                right->values[i - leftCount] = std::move(leaf->values[i]);
+                leaf->keys[i] = padding;
+                leaf->values[i] = Value();
+            }
+            right->count = leafCapacity - leftCount;
+            leaf->count = leftCount;
+            right->next = leaf->next;
+            leaf->next = right;
+            if (position > leftCount) {
+                target = right;
+                targetPosition = position - leftCount;
+            }
+            split = Split{right->keys[0], right};
+        }
+
+        for (std::size_t i = target->count; i > targetPosition; --i) {
+            target->keys[i] = target->keys[i - 1];
+            target->values[i] = std::move(target->values[i - 1]);
+        }
+        target->keys[targetPosition] = key;
+        target->values[targetPosition] = std::move(value);
+        ++target->count;
+        return split;
+    }
+
+    static void destroy(Node* node) noexcept {
+        if (node == nullptr) return;
+        if (node->leaf) {
+            delete static_cast<Leaf*>(node);
+            return;
+        }
+        auto inner = static_cast<Inner*>(node);
+        for (std::size_t i = 0; i <= inner->count; ++i) {
+            destroy(inner->children[i]);
+        }
+        delete inner;
+    }
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_BTREE
@@ -0,0 +1,385 @@
+// strong-index-containers.hpp: containers which can only be accessed with
+// one particular kind of StrongIndex.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_CONTAINERS
+#define STRONG_INDEX_CONTAINERS
+
+#include "strong-index.hpp"
+
+#include <array>
+#include <bit>          // countr_zero, popcount
+#include <cstddef>      // size_t, ptrdiff_t
+#include <cstdint>      // uint64_t
+#include <functional>   // invoke
+#include <iterator>     // forward_iterator_tag
+#include <memory>       // allocator
+#include <stdexcept>    // out_of_range
+#include <type_traits>  // is_signed
+#include <utility>      // move
+#include <vector>
+
+namespace StrongIndex {
+
+// The position in a container which an index refers to. A plain
+// static_cast<std::size_t> only works if the underlying type is size_t.
+template<class Index>
+constexpr std::size_t to_position(Index index) noexcept {
+    return static_cast<std::size_t>(
+            static_cast<typename Index::Underlying>(index));
+}
+
+// An IndexRange is the half-open interval [first, last) of indices. It can be
+// iterated over like a container, producing each index in turn, even for
+// index types which can't be incremented themselves.
+template<class Index>
+class IndexRange {
+  private:
+    using T = typename Index::Underlying;
+
+  public:
+    class iterator {
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Index;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Index*;
+        using reference = Index;
+
+        constexpr iterator() noexcept = default;
+        constexpr explicit iterator(T position) noexcept:
+                position_(position) {
+        }
+
+        constexpr Index operator*() const noexcept { return Index(position_); }
+
+        constexpr iterator& operator++() noexcept {
+            ++position_;
+            return *this;
+        }
+
+        constexpr iterator operator++(int) noexcept {
+            iterator oldValue(*this);
+            ++position_;
+            return oldValue;
+        }
+
+        constexpr friend bool operator==(const iterator& a,
+                                         const iterator& b) noexcept {
+            return a.position_ == b.position_;
+        }
+
+        constexpr friend bool operator!=(const iterator& a,
+                                         const iterator& b) noexcept {
+            return !(a == b);
+        }
+
+      private:
+        T position_ = T();
+    };
+
+    constexpr IndexRange(Index first, Index last) noexcept:
+            first_(static_cast<T>(first)), last_(static_cast<T>(last)) {
+    }
+
+    constexpr Index first() const noexcept { return Index(first_); }
+    constexpr Index last() const noexcept { return Index(last_); }
+
+    constexpr std::size_t size() const noexcept {
+        return last_ > first_ ? static_cast<std::size_t>(last_ - first_) : 0;
+    }
+
+    constexpr bool empty() const noexcept { return size() == 0; }
+
+    constexpr bool contains(Index index) const noexcept {
+        return first_ <= static_cast<T>(index) && static_cast<T>(index) < last_;
+    }
+
+    constexpr iterator begin() const noexcept { return iterator(first_); }
+    constexpr iterator end() const noexcept {
+        return iterator(last_ > first_ ? last_ : first_);
+    }
+
+    constexpr friend bool operator==(const IndexRange& a,
+                                     const IndexRange& b) noexcept {
+        return a.first_ == b.first_ && a.last_ == b.last_;
+    }
+
+    constexpr friend bool operator!=(const IndexRange& a,
+                                     const IndexRange& b) noexcept {
+        return !(a == b);
+    }
+
+  private:
+    T first_;
+    T last_;
+};
+
+// An IndexedVector is a std::vector which can only be accessed with one kind
+// of index, so a UserId can't be used to look something up in a table of
+// students. The allocator can be replaced just like std::vector's, e.g. with
+// the HugePageAllocator from strong-index-huge-pages.hpp.
+template<class Index, class Value, class Allocator = std::allocator<Value>>
+class IndexedVector {
+  public:
+    using Storage = std::vector<Value, Allocator>;
+    using iterator = typename Storage::iterator;
+    using const_iterator = typename Storage::const_iterator;
+
+    IndexedVector() = default;
+
+    explicit IndexedVector(const Allocator& allocator): values_(allocator) {
+    }
+
+    explicit IndexedVector(std::size_t size,
+                           const Allocator& allocator = Allocator()):
+            values_(size, allocator) {
+    }
+
+    IndexedVector(std::size_t size, const Value& value,
+                  const Allocator& allocator = Allocator()):
+            values_(size, value, allocator) {
+    }
+
+    Value& operator[](Index index) noexcept {
+        return values_[to_position(index)];
+    }
+
+    const Value& operator[](Index index) const noexcept {
+        return values_[to_position(index)];
+    }
+
+    // Like operator[], but throws std::out_of_range for a bad index.
+    Value& at(Index index) {
+        return values_.at(to_position(index));
+    }
+
+    const Value& at(Index index) const {
+        return values_.at(to_position(index));
+    }
+
+    // Appends a value and returns the index it can be found at.
+    Index push_back(Value value) {
+        values_.push_back(std::move(value));
+        return Index(static_cast<typename Index::Underlying>(
+                values_.size() - 1));
+    }
+
+    std::size_t size() const noexcept { return values_.size(); }
+    bool empty() const noexcept { return values_.empty(); }
+    void reserve(std::size_t capacity) { values_.reserve(capacity); }
+    void resize(std::size_t size) { values_.resize(size); }
+    void resize(std::size_t size, const Value& value) {
+        values_.resize(size, value);
+    }
+    void clear() noexcept { values_.clear(); }
+
+    // Every valid index, in order.
+    IndexRange<Index> indices() const noexcept {
+        using T = typename Index::Underlying;
+        return IndexRange<Index>(Index(T()),
+                                 Index(static_cast<T>(values_.size())));
+    }
+
+    Value* data() noexcept { return values_.data(); }
+    const Value* data() const noexcept { return values_.data(); }
+
+    iterator begin() noexcept { return values_.begin(); }
+    iterator end() noexcept { return values_.end(); }
+    const_iterator begin() const noexcept { return values_.begin(); }
+    const_iterator end() const noexcept { return values_.end(); }
+
+    // The untyped vector, for handing off to code which doesn't know about
+    // the index type.
+    const Storage& storage() const noexcept { return values_; }
+
+  private:
+    Storage values_;
+};
+
+// An IndexBitmap is a set of indices in [0, size()) stored as one bit each.
+// Index i is bit i % 64 of word i / 64, the same layout as Arrow's validity
+// bitmaps, and bits past size() are always zero. for_each_set() skips over
+// whole words of zeros, so iterating a sparse bitmap is cheap.
+template<class Index>
+class IndexBitmap {
+  private:
+    using T = typename Index::Underlying;
+
+  public:
+    IndexBitmap() = default;
+
+    explicit IndexBitmap(std::size_t size, bool value = false) {
+        resize(size, value);
+    }
+
+    std::size_t size() const noexcept { return size_; }
+
+    void reserve(std::size_t capacity) { words_.reserve((capacity + 63) / 64); }
+
+    void resize(std::size_t size, bool value = false) {
+        const std::size_t oldSize = size_;
+        words_.resize((size + 63) / 64, 0);
+        size_ = size;
+        if (value) {
+            for (std::size_t i = oldSize; i < size && i % 64 != 0; ++i) {
+                words_[i / 64] |= bit(i);
+            }
+            for (std::size_t w = (oldSize + 63) / 64; w < words_.size(); ++w) {
+                words_[w] = ~std::uint64_t(0);
+            }
+        }
+        clear_tail();
+    }
+
+    void push_back(bool value) {
+        resize(size_ + 1);
+        if (value) words_[(size_ - 1) / 64] |= bit(size_ - 1);
+    }
+
+    bool test(Index index) const noexcept {
+        const std::size_t i = to_position(index);
+        return (words_[i / 64] & bit(i)) != 0;
+    }
+
+    void set(Index index) noexcept {
+        const std::size_t i = to_position(index);
+        words_[i / 64] |= bit(i);
+    }
+
+    void reset(Index index) noexcept {
+        const std::size_t i = to_position(index);
+        words_[i / 64] &= ~bit(i);
+    }
+
+    void assign(Index index, bool value) noexcept {
+        value ? set(index) : reset(index);
+    }
+
+    void reset_all() noexcept {
+        for (std::uint64_t& word : words_) word = 0;
+    }
+
+    // The number of indices in the set.
+    std::size_t count() const noexcept {
+        std::size_t total = 0;
+        for (std::uint64_t word : words_) total += std::popcount(word);
+        return total;
+    }
+
+    // Calls function(Index) on each index in the set, in order.
+    template<class Function>
+    void for_each_set(Function function) const {
+        for (std::size_t w = 0; w < words_.size(); ++w) {
+            for (std::uint64_t word = words_[w]; word != 0;
+                 word &= word - 1) {
+                const std::size_t i = w * 64 + std::countr_zero(word);
+                std::invoke(function, Index(static_cast<T>(i)));
+            }
+        }
+    }
+
+    // The raw words, e.g. for handing the bitmap to other code.
+    const std::vector<std::uint64_t>& words() const noexcept { return words_; }
+
+  private:
+    std::vector<std::uint64_t> words_;
+    std::size_t size_ = 0;
+
+    static constexpr std::uint64_t bit(std::size_t i) noexcept {
+        return std::uint64_t(1) << (i % 64);
+    }
+
+    void clear_tail() noexcept {
+        if (size_ % 64 != 0) words_.back() &= bit(size_) - 1;
+    }
+};
+
+// An IndexedArray is the fixed-size counterpart of IndexedVector, for small
+// index spaces whose size is known at compile time, like 24 hourly buckets or
+// 8 priority levels. Everything is constexpr, so it can be used to build
+// lookup tables at compile time.
+//
+// operator[] never checks bounds. Instead, indices can be made with index<I>(),
+// which is checked at compile time, or make_index(), which throws
+// std::out_of_range at runtime and fails to compile in a constant expression.
+template<class Index, class Value, std::size_t N>
+class IndexedArray {
+  private:
+    using T = typename Index::Underlying;
+
+  public:
+    using Storage = std::array<Value, N>;
+    using iterator = typename Storage::iterator;
+    using const_iterator = typename Storage::const_iterator;
+
+    constexpr IndexedArray() = default;
+
+    constexpr explicit IndexedArray(const Storage& values): values_(values) {
+    }
+
+    template<std::size_t I>
+    static constexpr Index index() noexcept {
+        static_assert(I < N, "Index is out of range for this IndexedArray.");
+        return Index(static_cast<T>(I));
+    }
+
+    static constexpr Index make_index(T value) {
+        if constexpr (std::is_signed_v<T>) {
+            if (value < T()) {
+                throw std::out_of_range("Index is out of range.");
+            }
+        }
+        if (static_cast<std::size_t>(value) >= N) {
+            throw std::out_of_range("Index is out of range.");
+        }
+        return Index(value);
+    }
+
+    constexpr Value& operator[](Index index) noexcept {
+        return values_[to_position(index)];
+    }
+
+    constexpr const Value& operator[](Index index) const noexcept {
+        return values_[to_position(index)];
+    }
+
+    // Like operator[], but throws std::out_of_range for a bad index.
+    constexpr Value& at(Index index) {
+        return values_[to_position(make_index(static_cast<T>(index)))];
+    }
+
+    constexpr const Value& at(Index index) const {
+        return values_[to_position(make_index(static_cast<T>(index)))];
+    }
+
+    static constexpr std::size_t size() noexcept { return N; }
+
+    // Every valid index, in order.
+    static constexpr IndexRange<Index> indices() noexcept {
+        return IndexRange<Index>(Index(T()), Index(static_cast<T>(N)));
+    }
+
+    constexpr void fill(const Value& value) {
+        for (Value& element : values_) element = value;
+    }
+
+    constexpr Value* data() noexcept { return values_.data(); }
+    constexpr const Value* data() const noexcept { return values_.data(); }
+
+    constexpr iterator begin() noexcept { return values_.begin(); }
+    constexpr iterator end() noexcept { return values_.end(); }
+    constexpr const_iterator begin() const noexcept { return values_.begin(); }
+    constexpr const_iterator end() const noexcept { return values_.end(); }
+
+    constexpr const Storage& storage() const noexcept { return values_; }
+
+  private:
+    Storage values_{};
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_CONTAINERS
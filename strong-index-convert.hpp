@@ -0,0 +1,120 @@
+// strong-index-convert.hpp: bulk conversion of indices between underlying
+// types of different widths.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_CONVERT
+#define STRONG_INDEX_CONVERT
+
+#include "strong-index.hpp"
+
+#include <algorithm>    // min
+#include <cstddef>      // size_t
+#include <limits>       // numeric_limits
+#include <span>
+#include <stdexcept>    // invalid_argument, out_of_range
+#include <string>       // to_string
+#include <type_traits>  // is_same, remove_const
+#include <utility>      // in_range
+#include <vector>
+
+namespace StrongIndex {
+
+// True if To is the same kind of index as From, with the same tag, differing
+// only in its underlying type. Only such pairs can be converted, so a 64-bit
+// UserId can become a 32-bit UserId but never a 32-bit OrderId.
+template<class To, class From>
+inline constexpr bool isRebindOf = std::is_same_v<
+        typename From::template Rebind<typename To::Underlying>, To>;
+
+// Converts indices to a narrower underlying type, e.g.
+//     narrow<UserId32>(std::span(userIds64), std::span(userIds32));
+// Returns the number of indices converted, which is in.size() if they all
+// fit, and otherwise the position of the first index which doesn't fit.
+// Everything before that position has been converted. out must be at least as
+// long as in.
+//
+// The input is handled in blocks: each block is first checked with a
+// branch-free reduction and then converted with a plain loop, both of which
+// the compiler vectorizes. Only a block containing a failure is rescanned to
+// find the exact position.
+template<class To, class From>
+std::size_t narrow(std::span<From> in, std::span<To> out) {
+    using Source = std::remove_const_t<From>;
+    using FromT = typename Source::Underlying;
+    using ToT = typename To::Underlying;
+    static_assert(isRebindOf<To, Source>,
+                  "Indices can only be narrowed to the same kind of index.");
+    if (out.size() < in.size()) {
+        throw std::invalid_argument("narrow() output is shorter than input.");
+    }
+
+    constexpr std::size_t blockSize = 256;
+    for (std::size_t start = 0; start < in.size(); start += blockSize) {
+        const std::size_t end = std::min(start + blockSize, in.size());
+        bool fits = true;
+        for (std::size_t i = start; i < end; ++i) {
+            fits &= std::in_range<ToT>(static_cast<FromT>(in[i]));
+        }
+
+        std::size_t convertible = end;
+        if (!fits) {
+            convertible = start;
+            while (std::in_range<ToT>(static_cast<FromT>(in[convertible]))) {
+                ++convertible;
+            }
+        }
+        for (std::size_t i = start; i < convertible; ++i) {
+            out[i] = To(static_cast<ToT>(static_cast<FromT>(in[i])));
+        }
+        if (!fits) return convertible;
+    }
+    return in.size();
+}
+
+// Like narrow() above, but returns a new vector and throws std::out_of_range
+// naming the first position which doesn't fit.
+template<class To, class From>
+std::vector<To> narrow(std::span<From> in) {
+    std::vector<To> out(in.size(), To(typename To::Underlying()));
+    const std::size_t converted = narrow<To>(in, std::span<To>(out));
+    if (converted != in.size()) {
+        throw std::out_of_range("Index at position "
+                                + std::to_string(converted)
+                                + " does not fit in the narrower type.");
+    }
+    return out;
+}
+
+// Converts indices to a wider underlying type, which always succeeds. out must
+// be at least as long as in.
+template<class To, class From>
+void widen(std::span<From> in, std::span<To> out) {
+    using Source = std::remove_const_t<From>;
+    using FromT = typename Source::Underlying;
+    using ToT = typename To::Underlying;
+    static_assert(isRebindOf<To, Source>,
+                  "Indices can only be widened to the same kind of index.");
+    static_assert(std::in_range<ToT>(std::numeric_limits<FromT>::min())
+                  && std::in_range<ToT>(std::numeric_limits<FromT>::max()),
+                  "widen() can't hold every value; use narrow() instead.");
+    if (out.size() < in.size()) {
+        throw std::invalid_argument("widen() output is shorter than input.");
+    }
+
+    for (std::size_t i = 0; i < in.size(); ++i) {
+        out[i] = To(static_cast<ToT>(static_cast<FromT>(in[i])));
+    }
+}
+
+template<class To, class From>
+std::vector<To> widen(std::span<From> in) {
+    std::vector<To> out(in.size(), To(typename To::Underlying()));
+    widen<To>(in, std::span<To>(out));
+    return out;
+}
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_CONVERT
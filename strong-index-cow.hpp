@@ -0,0 +1,149 @@
+// strong-index-cow.hpp: index-keyed columns with cheap copy-on-write
+// snapshots for concurrent readers.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_COW
+#define STRONG_INDEX_COW
+
+#include "strong-index-containers.hpp"
+
+#include <algorithm>    // max
+#include <array>
+#include <atomic>       // atomic_thread_fence
+#include <cstddef>      // size_t
+#include <memory>       // make_shared, shared_ptr
+#include <utility>      // move
+#include <vector>
+
+namespace StrongIndex {
+
+// A CowColumn is an index-keyed array which can hand out read-only snapshots
+// of itself. The values are stored in pages of roughly PageBytes each, and a
+// snapshot shares the column's table of pages, so taking one is O(1) no matter
+// how big the column is. The first write to a page after a snapshot copies
+// just that page (and, once per snapshot, the table of page pointers), so the
+// snapshot keeps seeing the old values while the writer carries on.
+//
+// Writes and snapshot() must all happen on one writer thread (or be
+// synchronized with each other). Snapshots can then be handed to any number
+// of reader threads, read without any locking, and destroyed anywhere.
+template<class Index, class Value, std::size_t PageBytes = 4096>
+class CowColumn {
+  public:
+    static constexpr std::size_t pageSize
+            = std::max<std::size_t>(1, PageBytes / sizeof(Value));
+
+  private:
+    using Page = std::array<Value, pageSize>;
+    using PageTable = std::vector<std::shared_ptr<Page>>;
+
+  public:
+    // A frozen view of the column at the time snapshot() was called.
+    class Snapshot {
+      public:
+        Snapshot() = default;
+
+        const Value& operator[](Index index) const noexcept {
+            const std::size_t i = to_position(index);
+            return (*(*table_)[i / pageSize])[i % pageSize];
+        }
+
+        std::size_t size() const noexcept { return size_; }
+
+      private:
+        friend class CowColumn;
+
+        Snapshot(std::shared_ptr<const PageTable> table, std::size_t size)
+                noexcept: table_(std::move(table)), size_(size) {
+        }
+
+        std::shared_ptr<const PageTable> table_
+                = std::make_shared<const PageTable>();
+        std::size_t size_ = 0;
+    };
+
+    CowColumn(): table_(std::make_shared<PageTable>()) {
+    }
+
+    explicit CowColumn(std::size_t size, const Value& value = Value()):
+            CowColumn() {
+        for (std::size_t i = 0; i < size; ++i) push_back(value);
+    }
+
+    std::size_t size() const noexcept { return size_; }
+
+    const Value& operator[](Index index) const noexcept {
+        const std::size_t i = to_position(index);
+        return (*(*table_)[i / pageSize])[i % pageSize];
+    }
+
+    // Writable access to one value, copying its page first if a snapshot
+    // still uses it.
+    Value& mutable_at(Index index) {
+        const std::size_t i = to_position(index);
+        return (*writable_page(i / pageSize))[i % pageSize];
+    }
+
+    void set(Index index, Value value) {
+        mutable_at(index) = std::move(value);
+    }
+
+    Index push_back(Value value) {
+        if (size_ % pageSize == 0) {
+            writable_table().push_back(std::make_shared<Page>());
+        }
+        (*writable_page(size_ / pageSize))[size_ % pageSize] = std::move(value);
+        using T = typename Index::Underlying;
+        return Index(static_cast<T>(size_++));
+    }
+
+    Snapshot snapshot() const noexcept {
+        return Snapshot(table_, size_);
+    }
+
+    // How many pages this column still shares with a snapshot, i.e. how many
+    // it hasn't had to copy.
+    std::size_t pages_shared_with(const Snapshot& snapshot) const noexcept {
+        std::size_t shared = 0;
+        const std::size_t pages = std::min(table_->size(),
+                                           snapshot.table_->size());
+        for (std::size_t p = 0; p < pages; ++p) {
+            shared += (*table_)[p] == (*snapshot.table_)[p];
+        }
+        return shared;
+    }
+
+  private:
+    std::shared_ptr<PageTable> table_;
+    std::size_t size_ = 0;
+
+    // Only the writer ever adds owners, so a count of one can't go up behind
+    // our back. The fence pairs with the release in the shared_ptr decrement
+    // of whichever reader dropped the last other reference, so its reads
+    // happen before our writes.
+    template<class T>
+    static bool unshared(const std::shared_ptr<T>& pointer) noexcept {
+        if (pointer.use_count() != 1) return false;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
+
+    PageTable& writable_table() {
+        if (!unshared(table_)) table_ = std::make_shared<PageTable>(*table_);
+        return *table_;
+    }
+
+    Page* writable_page(std::size_t page) {
+        PageTable& table = writable_table();
+        if (!unshared(table[page])) {
+            table[page] = std::make_shared<Page>(*table[page]);
+        }
+        return table[page].get();
+    }
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_COW
@@ -0,0 +1,187 @@
+// strong-index-dictionary.hpp: dictionary encoding of low-cardinality
+// columns into compact, typed codes.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_DICTIONARY
+#define STRONG_INDEX_DICTIONARY
+
+#include "strong-index.hpp"
+#include "strong-index-containers.hpp"
+#include "strong-index-packed-vector.hpp"
+
+#include <algorithm>    // min
+#include <cstddef>      // size_t
+#include <cstdint>      // uint32_t
+#include <functional>   // hash, invoke
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <utility>      // move, swap
+#include <vector>
+
+namespace StrongIndex {
+
+// A Dictionary assigns each distinct value a code, 0, 1, 2... in the order
+// they are first seen. Codes are Basic<Tag, uint32_t> indices, so each
+// dictionary should have its own Tag, and then a country code can't be
+// looked up in the device dictionary.
+template<class Tag, class Value = std::string, class Hash = std::hash<Value>>
+class Dictionary {
+  public:
+    using Code = Basic<Tag, std::uint32_t>;
+
+    Dictionary() = default;
+
+    // The number of distinct values.
+    std::size_t size() const noexcept { return values_.size(); }
+
+    // The code for value, adding it to the dictionary if it's new.
+    Code encode(const Value& value) {
+        auto [found, added] = codes_.try_emplace(
+                value, static_cast<std::uint32_t>(values_.size()));
+        if (added) values_.push_back(value);
+        return Code(found->second);
+    }
+
+    // The code for value, if it's in the dictionary.
+    std::optional<Code> find(const Value& value) const {
+        auto found = codes_.find(value);
+        if (found == codes_.end()) return std::nullopt;
+        return Code(found->second);
+    }
+
+    const Value& operator[](Code code) const noexcept { return values_[code]; }
+
+    // The set of codes whose values satisfy predicate(const Value&). This is
+    // how predicates are moved from values to codes: the predicate is
+    // evaluated once per distinct value, and rows then only need a bit test.
+    template<class Predicate>
+    IndexBitmap<Code> matching(Predicate predicate) const {
+        IndexBitmap<Code> codes(values_.size());
+        for (Code code : values_.indices()) {
+            if (std::invoke(predicate, values_[code])) codes.set(code);
+        }
+        return codes;
+    }
+
+    // Every value, in code order.
+    const IndexedVector<Code, Value>& values() const noexcept {
+        return values_;
+    }
+
+  private:
+    IndexedVector<Code, Value> values_;
+    std::unordered_map<Value, std::uint32_t, Hash> codes_;
+};
+
+// A DictionaryColumn is an index-keyed column of values stored as codes into
+// its own Dictionary, packed into as few bits as the dictionary's size
+// needs. A column of country names with 200 distinct values takes 8 bits a
+// row, and grows a bit wider only when the dictionary outgrows the current
+// width.
+//
+// Filters run on the codes: the value being looked for is turned into a code
+// (or a set of codes) once, and then the packed codes are unpacked in blocks
+// and compared as integers. Filters return an IndexBitmap of matching rows.
+template<class RowIndex, class Tag, class Value = std::string>
+class DictionaryColumn {
+  private:
+    using T = typename RowIndex::Underlying;
+
+  public:
+    using Dictionary = StrongIndex::Dictionary<Tag, Value>;
+    using Code = typename Dictionary::Code;
+
+    DictionaryColumn(): codes_(1) {
+    }
+
+    std::size_t size() const noexcept { return codes_.size(); }
+    bool empty() const noexcept { return codes_.empty(); }
+
+    // The width of each code, and the memory they take up in total.
+    unsigned bits() const noexcept { return codes_.bits(); }
+    std::size_t bytes() const noexcept { return codes_.bytes(); }
+
+    RowIndex push_back(const Value& value) {
+        const Code code = dictionary_.encode(value);
+        if (static_cast<std::uint32_t>(code) > codes_.max_value()) widen();
+        codes_.push_back(code);
+        return RowIndex(static_cast<T>(codes_.size() - 1));
+    }
+
+    Code code(RowIndex row) const noexcept {
+        return codes_[to_position(row)];
+    }
+
+    const Value& operator[](RowIndex row) const noexcept {
+        return dictionary_[code(row)];
+    }
+
+    // The rows holding value.
+    IndexBitmap<RowIndex> where_equal(const Value& value) const {
+        const std::optional<Code> wanted = dictionary_.find(value);
+        if (!wanted) return IndexBitmap<RowIndex>(size());
+        return scan([wanted = *wanted](Code code) { return code == wanted; });
+    }
+
+    // The rows whose values satisfy predicate(const Value&). The predicate
+    // is only called once per distinct value.
+    template<class Predicate>
+    IndexBitmap<RowIndex> where(Predicate predicate) const {
+        const IndexBitmap<Code> codes = dictionary_.matching(
+                std::move(predicate));
+        return scan([&codes](Code code) { return codes.test(code); });
+    }
+
+    const Dictionary& dictionary() const noexcept { return dictionary_; }
+    const PackedIndexVector<Code>& codes() const noexcept { return codes_; }
+
+  private:
+    static constexpr std::size_t blockSize = 256;
+
+    Dictionary dictionary_;
+    PackedIndexVector<Code> codes_;
+
+    // Calls function(std::size_t first, std::span<const Code>) on each block
+    // of unpacked codes, in order.
+    template<class Function>
+    void for_each_block(Function function) const {
+        std::vector<Code> block(blockSize, Code(0));
+        for (std::size_t first = 0; first < size(); first += blockSize) {
+            const std::size_t length = std::min(blockSize, size() - first);
+            std::span<Code> codes(block.data(), length);
+            codes_.unpack(first, codes);
+            function(first, std::span<const Code>(codes));
+        }
+    }
+
+    template<class Match>
+    IndexBitmap<RowIndex> scan(Match match) const {
+        IndexBitmap<RowIndex> rows(size());
+        for_each_block([&](std::size_t first, std::span<const Code> codes) {
+            for (std::size_t i = 0; i < codes.size(); ++i) {
+                if (match(codes[i])) {
+                    rows.set(RowIndex(static_cast<T>(first + i)));
+                }
+            }
+        });
+        return rows;
+    }
+
+    // Repacks the codes one bit wider.
+    void widen() {
+        PackedIndexVector<Code> wider(codes_.bits() + 1);
+        wider.reserve(size());
+        for_each_block([&](std::size_t, std::span<const Code> codes) {
+            for (Code code : codes) wider.push_back(code);
+        });
+        std::swap(codes_, wider);
+    }
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_DICTIONARY
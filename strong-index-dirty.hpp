@@ -0,0 +1,178 @@
+// strong-index-dirty.hpp: tracking which indices have changed, so derived
+// data can be brought up to date in time proportional to the changes.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_DIRTY
+#define STRONG_INDEX_DIRTY
+
+#include "strong-index-containers.hpp"
+
+#include <cstddef>      // size_t
+#include <functional>   // invoke
+#include <utility>      // move
+#include <vector>       // erase_if
+
+namespace StrongIndex {
+
+// A DirtySet is a set of indices in [0, size()) which supports the pattern
+// "mark whatever changes, then visit each changed index once and clear".
+// Membership is a bitmap, so marking the same index twice is cheap and
+// doesn't record it twice, and the marked indices are also kept in a list so
+// that visiting and clearing them costs O(changes) rather than O(size()).
+//
+// When a large fraction of the indices are dirty, for_each() scans the bitmap
+// instead of the list, which is faster than jumping around in index order.
+template<class Index>
+class DirtySet {
+  public:
+    DirtySet() = default;
+
+    explicit DirtySet(std::size_t size): bits_(size) {
+    }
+
+    // Indices beyond the old size start out clean. Shrinking drops any marked
+    // indices which no longer fit.
+    void resize(std::size_t size) {
+        if (size < bits_.size()) {
+            std::erase_if(list_, [size](Index index) {
+                return to_position(index) >= size;
+            });
+        }
+        bits_.resize(size);
+    }
+
+    std::size_t size() const noexcept { return bits_.size(); }
+
+    // The number of dirty indices.
+    std::size_t count() const noexcept { return list_.size(); }
+    bool empty() const noexcept { return list_.empty(); }
+
+    bool contains(Index index) const noexcept { return bits_.test(index); }
+
+    // Marks an index as dirty. Returns false if it already was.
+    bool mark(Index index) {
+        if (bits_.test(index)) return false;
+        bits_.set(index);
+        list_.push_back(index);
+        return true;
+    }
+
+    // Marks every index, e.g. so that the first incremental pass computes
+    // everything.
+    void mark_all() {
+        using T = typename Index::Underlying;
+        list_.clear();
+        list_.reserve(bits_.size());
+        for (std::size_t i = 0; i < bits_.size(); ++i) {
+            list_.push_back(Index(static_cast<T>(i)));
+        }
+        bits_ = IndexBitmap<Index>(bits_.size(), true);
+    }
+
+    // Calls function(Index) on each dirty index, in no particular order.
+    template<class Function>
+    void for_each(Function function) const {
+        if (list_.size() > bits_.size() / denseFraction) {
+            bits_.for_each_set(function);
+        } else {
+            for (Index index : list_) std::invoke(function, index);
+        }
+    }
+
+    // Marks every index clean again, in O(count()).
+    void clear() noexcept {
+        if (list_.size() > bits_.size() / denseFraction) {
+            bits_.reset_all();
+        } else {
+            for (Index index : list_) bits_.reset(index);
+        }
+        list_.clear();
+    }
+
+    // Calls function(Index) on each dirty index and then clears them all.
+    template<class Function>
+    void drain(Function function) {
+        for_each(std::move(function));
+        clear();
+    }
+
+    const IndexBitmap<Index>& bitmap() const noexcept { return bits_; }
+
+  private:
+    // Above one dirty index in this many, scanning the bitmap is cheaper
+    // than following the list.
+    static constexpr std::size_t denseFraction = 16;
+
+    IndexBitmap<Index> bits_;
+    std::vector<Index> list_;
+};
+
+// A TrackedVector is an IndexedVector which remembers which elements have
+// been written since the last time its changes were consumed. Reads go
+// through operator[], which is const; every write goes through set(),
+// mutable_at() or push_back() and marks the element dirty.
+template<class Index, class Value>
+class TrackedVector {
+  public:
+    TrackedVector() = default;
+
+    explicit TrackedVector(std::size_t size, const Value& value = Value()):
+            values_(size, value), dirty_(size) {
+    }
+
+    std::size_t size() const noexcept { return values_.size(); }
+    bool empty() const noexcept { return values_.empty(); }
+    void reserve(std::size_t capacity) { values_.reserve(capacity); }
+
+    const Value& operator[](Index index) const noexcept {
+        return values_[index];
+    }
+
+    // Writable access to one element, which is marked dirty whether or not
+    // it is actually changed.
+    Value& mutable_at(Index index) {
+        dirty_.mark(index);
+        return values_[index];
+    }
+
+    void set(Index index, Value value) {
+        mutable_at(index) = std::move(value);
+    }
+
+    // New elements are dirty.
+    Index push_back(Value value) {
+        const Index index = values_.push_back(std::move(value));
+        dirty_.resize(values_.size());
+        dirty_.mark(index);
+        return index;
+    }
+
+    IndexRange<Index> indices() const noexcept { return values_.indices(); }
+
+    const DirtySet<Index>& dirty() const noexcept { return dirty_; }
+
+    // Calls function(Index, const Value&) on each element written since the
+    // last call, then marks them all clean.
+    template<class Function>
+    void consume_changes(Function function) {
+        dirty_.drain([&](Index index) {
+            std::invoke(function, index, values_[index]);
+        });
+    }
+
+    void mark_all_dirty() { dirty_.mark_all(); }
+
+    const IndexedVector<Index, Value>& values() const noexcept {
+        return values_;
+    }
+
+  private:
+    IndexedVector<Index, Value> values_;
+    DirtySet<Index> dirty_;
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_DIRTY
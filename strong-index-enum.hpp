@@ -0,0 +1,82 @@
+// strong-index-enum.hpp: indices made from enums, for dense tables with one
+// entry per enumerator.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_ENUM
+#define STRONG_INDEX_ENUM
+
+#include "strong-index-containers.hpp"
+
+#include <cstddef>      // size_t
+#include <iostream>     // operator<<
+#include <type_traits>  // is_enum, underlying_type
+
+namespace StrongIndex {
+
+// An EnumIndex<Enum> is an index whose values are the enumerators of Enum, so
+// an enum can be used to look things up in a table without casts. The enum's
+// values must run from 0 to a final sentinel enumerator which isn't itself a
+// real value and which gives the number of values, e.g.
+//     enum class State { Idle, Running, Done, Count };
+// By default the sentinel is called Count, but any enumerator can be used.
+//
+// Any enumerator converts implicitly to an EnumIndex, and value() converts
+// back, so table[State::Running] works directly.
+template<class Enum, Enum Sentinel = Enum::Count>
+class EnumIndex {
+  public:
+    static_assert(std::is_enum_v<Enum>, "EnumIndex needs an enum type.");
+
+    using Underlying = std::underlying_type_t<Enum>;
+
+    static constexpr std::size_t count = static_cast<std::size_t>(Sentinel);
+
+    constexpr EnumIndex(Enum value) noexcept: value_(value) {
+    }
+
+    constexpr explicit EnumIndex(Underlying underlyingIndex) noexcept:
+            value_(static_cast<Enum>(underlyingIndex)) {
+    }
+
+    constexpr explicit operator Underlying() const noexcept {
+        return static_cast<Underlying>(value_);
+    }
+
+    constexpr Enum value() const noexcept { return value_; }
+
+    // Every value of the enum, in order, not including the sentinel.
+    static constexpr IndexRange<EnumIndex> all() noexcept {
+        return IndexRange<EnumIndex>(EnumIndex(Underlying()),
+                                     EnumIndex(Sentinel));
+    }
+
+    constexpr friend bool operator==(const EnumIndex& a,
+                                     const EnumIndex& b) noexcept {
+        return a.value_ == b.value_;
+    }
+
+    constexpr friend bool operator!=(const EnumIndex& a,
+                                     const EnumIndex& b) noexcept {
+        return !(a == b);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const EnumIndex& idx) {
+        return os << +static_cast<Underlying>(idx.value_);
+    }
+
+  private:
+    Enum value_;
+};
+
+// An array with one Value for each enumerator of Enum, e.g. the handler for
+// each state of a state machine. Looking up an entry is a plain array access,
+// so dispatching through an EnumArray of function pointers needs no switch.
+template<class Enum, class Value, Enum Sentinel = Enum::Count>
+using EnumArray = IndexedArray<EnumIndex<Enum, Sentinel>, Value,
+                               EnumIndex<Enum, Sentinel>::count>;
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_ENUM
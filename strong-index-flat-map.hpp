@@ -0,0 +1,193 @@
+// strong-index-flat-map.hpp: a sorted map from indices to values which keeps
+// its keys and values in flat arrays.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_FLAT_MAP
+#define STRONG_INDEX_FLAT_MAP
+
+#include "strong-index.hpp"
+
+#include <algorithm>    // stable_sort
+#include <cstddef>      // size_t
+#include <functional>   // invoke
+#include <utility>      // move, pair
+#include <vector>
+
+namespace StrongIndex {
+
+// A FlatMap<Index, Value> is an ordered map for data which is read much more
+// than it is written. Keys are stored as their underlying integers in one
+// sorted array and values in another, in the same order, so lookups touch a
+// compact array of integers instead of chasing tree pointers and range scans
+// read both arrays sequentially.
+//
+// Searches are branchless binary searches over the key array, which avoid
+// mispredicted branches. Single inserts are O(n), so larger updates should be
+// done with insert_batch(), which sorts the new entries and merges them with
+// the existing ones in a single pass.
+template<class Index, class Value>
+class FlatMap {
+  private:
+    using T = typename Index::Underlying;
+
+  public:
+    FlatMap() = default;
+
+    std::size_t size() const noexcept { return keys_.size(); }
+    bool empty() const noexcept { return keys_.empty(); }
+
+    void reserve(std::size_t capacity) {
+        keys_.reserve(capacity);
+        values_.reserve(capacity);
+    }
+
+    void clear() noexcept {
+        keys_.clear();
+        values_.clear();
+    }
+
+    // The position of the first key not less than index, or size().
+    std::size_t lower_bound(Index index) const noexcept {
+        const T key = static_cast<T>(index);
+        const T* base = keys_.data();
+        std::size_t length = keys_.size();
+        if (length == 0) return 0;
+        while (length > 1) {
+            const std::size_t half = length / 2;
+            // This is a conditional move rather than a branch.
+            base = base[half] < key ? base + half : base;
+            length -= half;
+        }
+        return static_cast<std::size_t>(base - keys_.data()) + (*base < key);
+    }
+
+    bool contains(Index index) const noexcept {
+        const std::size_t position = lower_bound(index);
+        return position < keys_.size()
+               && keys_[position] == static_cast<T>(index);
+    }
+
+    Value* find(Index index) noexcept {
+        const std::size_t position = lower_bound(index);
+        if (position == keys_.size()
+            || keys_[position] != static_cast<T>(index)) {
+            return nullptr;
+        }
+        return &values_[position];
+    }
+
+    const Value* find(Index index) const noexcept {
+        return const_cast<FlatMap*>(this)->find(index);
+    }
+
+    // Inserts or overwrites a single entry. Returns true if the key is new.
+    bool insert_or_assign(Index index, Value value) {
+        const std::size_t position = lower_bound(index);
+        const T key = static_cast<T>(index);
+        if (position < keys_.size() && keys_[position] == key) {
+            values_[position] = std::move(value);
+            return false;
+        }
+        keys_.insert(keys_.begin() + position, key);
+        values_.insert(values_.begin() + position, std::move(value));
+        return true;
+    }
+
+    // Removes an entry. Returns true if it was there.
+    bool erase(Index index) {
+        const std::size_t position = lower_bound(index);
+        if (position == keys_.size()
+            || keys_[position] != static_cast<T>(index)) {
+            return false;
+        }
+        keys_.erase(keys_.begin() + position);
+        values_.erase(values_.begin() + position);
+        return true;
+    }
+
+    // Inserts many entries at once. If a key appears more than once in the
+    // batch, the last occurrence wins; keys already in the map are
+    // overwritten.
+    void insert_batch(std::vector<std::pair<Index, Value>> batch) {
+        std::stable_sort(batch.begin(), batch.end(),
+                         [](const auto& a, const auto& b) {
+                             return static_cast<T>(a.first)
+                                    < static_cast<T>(b.first);
+                         });
+
+        std::vector<T> keys;
+        std::vector<Value> values;
+        keys.reserve(keys_.size() + batch.size());
+        values.reserve(keys_.size() + batch.size());
+        std::size_t old = 0;
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            const T key = static_cast<T>(batch[i].first);
+            if (i + 1 < batch.size()
+                && static_cast<T>(batch[i + 1].first) == key) {
+                continue;
+            }
+            while (old < keys_.size() && keys_[old] < key) {
+                keys.push_back(keys_[old]);
+                values.push_back(std::move(values_[old]));
+                ++old;
+            }
+            if (old < keys_.size() && keys_[old] == key) ++old;
+            keys.push_back(key);
+            values.push_back(std::move(batch[i].second));
+        }
+        for (; old < keys_.size(); ++old) {
+            keys.push_back(keys_[old]);
+            values.push_back(std::move(values_[old]));
+        }
+        keys_ = std::move(keys);
+        values_ = std::move(values);
+    }
+
+    // The key and value at a position, in key order.
+    Index key_at(std::size_t position) const noexcept {
+        return Index(keys_[position]);
+    }
+
+    Value& value_at(std::size_t position) noexcept {
+        return values_[position];
+    }
+
+    const Value& value_at(std::size_t position) const noexcept {
+        return values_[position];
+    }
+
+    // Calls function(Index, Value&) for each entry with a key in
+    // [first, last), in key order.
+    template<class Function>
+    void for_each_in_range(Index first, Index last, Function function) {
+        const T end = static_cast<T>(last);
+        for (std::size_t i = lower_bound(first);
+             i < keys_.size() && keys_[i] < end; ++i) {
+            std::invoke(function, Index(keys_[i]), values_[i]);
+        }
+    }
+
+    template<class Function>
+    void for_each_in_range(Index first, Index last, Function function) const {
+        const T end = static_cast<T>(last);
+        for (std::size_t i = lower_bound(first);
+             i < keys_.size() && keys_[i] < end; ++i) {
+            std::invoke(function, Index(keys_[i]), values_[i]);
+        }
+    }
+
+    // The raw arrays, for handing off to code which doesn't know about the
+    // index type.
+    const std::vector<T>& keys() const noexcept { return keys_; }
+    const std::vector<Value>& values() const noexcept { return values_; }
+
+  private:
+    std::vector<T> keys_;
+    std::vector<Value> values_;
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_FLAT_MAP
@@ -0,0 +1,130 @@
+// strong-index-huge-pages.hpp: an allocator which backs large index-keyed
+// containers with huge pages.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_HUGE_PAGES
+#define STRONG_INDEX_HUGE_PAGES
+
+#include <cstddef>      // size_t
+#include <cstdint>      // uintptr_t
+#include <limits>       // numeric_limits
+#include <new>          // bad_alloc, operator new
+
+#if defined(__linux__)
+#include <sys/mman.h>   // mmap, madvise
+#endif
+
+namespace StrongIndex {
+
+// HugePageAllocator is a standard allocator meant for very large containers
+// which are accessed at random, e.g.
+//     IndexedVector<UserId, Score, HugePageAllocator<Score>>
+// Each 4 KiB page needs its own TLB entry, so random lookups into a table of
+// several GB miss the TLB almost every time; with 2 MiB pages the same table
+// needs 512 times fewer entries.
+//
+// Allocations of at least one huge page are served by mmap. Explicit 2 MiB
+// pages (MAP_HUGETLB | MAP_HUGE_2MB) are tried first, which only works if the
+// administrator has reserved some. Otherwise the memory is mapped normally, aligned to a
+// huge page boundary, and madvise(MADV_HUGEPAGE) asks for transparent huge
+// pages. If that isn't supported either we simply end up with normal pages.
+// Smaller allocations, and all allocations on other platforms, fall back to
+// operator new.
+template<typename T>
+class HugePageAllocator {
+  public:
+    using value_type = T;
+
+    static constexpr std::size_t hugePageSize = std::size_t(2) << 20;
+
+    HugePageAllocator() noexcept = default;
+
+    template<typename U>
+    HugePageAllocator(const HugePageAllocator<U>&) noexcept {
+    }
+
+    T* allocate(std::size_t count) {
+        if (count > std::numeric_limits<std::size_t>::max() / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+        const std::size_t bytes = count * sizeof(T);
+#if defined(__linux__)
+        if (bytes >= hugePageSize) {
+            return static_cast<T*>(map_huge(round_up(bytes)));
+        }
+#endif
+        return static_cast<T*>(::operator new(bytes,
+                                              std::align_val_t(alignof(T))));
+    }
+
+    void deallocate(T* pointer, std::size_t count) noexcept {
+        const std::size_t bytes = count * sizeof(T);
+#if defined(__linux__)
+        if (bytes >= hugePageSize) {
+            munmap(pointer, round_up(bytes));
+            return;
+        }
+#endif
+        ::operator delete(pointer, std::align_val_t(alignof(T)));
+    }
+
+    // All HugePageAllocators are interchangeable.
+    template<typename U>
+    constexpr friend bool operator==(const HugePageAllocator&,
+                                     const HugePageAllocator<U>&) noexcept {
+        return true;
+    }
+
+    template<typename U>
+    constexpr friend bool operator!=(const HugePageAllocator&,
+                                     const HugePageAllocator<U>&) noexcept {
+        return false;
+    }
+
+  private:
+    static constexpr std::size_t round_up(std::size_t bytes) noexcept {
+        return (bytes + hugePageSize - 1) & ~(hugePageSize - 1);
+    }
+
+#if defined(__linux__)
+    static void* map_huge(std::size_t bytes) {
+        constexpr int protection = PROT_READ | PROT_WRITE;
+        constexpr int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+        // The page size has to be asked for: the default hugetlb size may
+        // be 1 GiB, and a mapping of 1 GiB pages can't be unmapped in the
+        // 2 MiB units deallocate() uses.
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_2MB)
+        void* huge = mmap(nullptr, bytes, protection,
+                          flags | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+        if (huge != MAP_FAILED) return huge;
+#endif
+
+        // Transparent huge pages are only used for aligned 2 MiB ranges, so
+        // over-allocate by one huge page and trim off both ends.
+        void* raw = mmap(nullptr, bytes + hugePageSize, protection, flags,
+                         -1, 0);
+        if (raw == MAP_FAILED) throw std::bad_alloc();
+
+        const auto rawStart = reinterpret_cast<std::uintptr_t>(raw);
+        const auto start = (rawStart + hugePageSize - 1)
+                           & ~std::uintptr_t(hugePageSize - 1);
+        const std::size_t head = start - rawStart;
+        const std::size_t tail = hugePageSize - head;
+        if (head > 0) munmap(raw, head);
+        if (tail > 0) munmap(reinterpret_cast<void*>(start + bytes), tail);
+
+        void* aligned = reinterpret_cast<void*>(start);
+#if defined(MADV_HUGEPAGE)
+        madvise(aligned, bytes, MADV_HUGEPAGE);
+#endif
+        return aligned;
+    }
+#endif
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_HUGE_PAGES
@@ -0,0 +1,282 @@
+// strong-index-interleave.hpp: batches of lookups written as coroutines and
+// interleaved, so that their cache misses overlap instead of queueing up.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_INTERLEAVE
+#define STRONG_INDEX_INTERLEAVE
+
+#include "strong-index-btree.hpp"
+#include "strong-index-containers.hpp"
+#include "strong-index-flat-map.hpp"
+
+#include <coroutine>
+#include <cstddef>      // size_t
+#include <exception>    // exception_ptr
+#include <new>          // operator delete, operator new
+#include <optional>
+#include <span>
+#include <utility>      // exchange, move
+#include <vector>
+
+namespace StrongIndex {
+
+// An awaitable which starts loading the cache lines covering
+// [address, address + bytes) and then suspends the lookup, so the scheduler
+// can get on with other lookups while the memory arrives.
+class Prefetch {
+  public:
+    explicit Prefetch(const void* address, std::size_t bytes = 1) noexcept {
+#if defined(__GNUC__) || defined(__clang__)
+        const char* first = static_cast<const char*>(address);
+        for (std::size_t offset = 0; offset < bytes; offset += 64) {
+            __builtin_prefetch(first + offset);
+        }
+#else
+        (void)address;
+        (void)bytes;
+#endif
+    }
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<>) const noexcept {}
+    void await_resume() const noexcept {}
+};
+
+// The return type of a lookup coroutine which produces an R. A Lookup starts
+// suspended; each resume() runs it up to its next co_await Prefetch(...), or
+// to its co_return.
+//
+// Coroutine frames are recycled through a small per-thread cache, since a
+// batch creates one frame per lookup. The cache keeps a few sizes apart, so
+// batches over different containers don't evict each other's frames.
+template<class R>
+class Lookup {
+  public:
+    struct promise_type {
+        std::optional<R> result;
+        std::exception_ptr error;
+
+        Lookup get_return_object() noexcept {
+            return Lookup(Handle::from_promise(*this));
+        }
+
+        std::suspend_always initial_suspend() const noexcept { return {}; }
+        std::suspend_always final_suspend() const noexcept { return {}; }
+        void return_value(R value) { result.emplace(std::move(value)); }
+        void unhandled_exception() noexcept {
+            error = std::current_exception();
+        }
+
+        static void* operator new(std::size_t size) {
+            if (!cache_destroyed()) {
+                auto* bin = frame_cache().bin(size);
+                if (bin != nullptr && bin->count > 0) {
+                    return bin->frames[--bin->count];
+                }
+            }
+            return ::operator new(size);
+        }
+
+        // A frame freed during thread exit, after the cache is gone, e.g.
+        // by a thread_local which holds a Lookup, goes straight back.
+        static void operator delete(void* frame, std::size_t size) noexcept {
+            if (!cache_destroyed()) {
+                auto* bin = frame_cache().bin(size);
+                if (bin != nullptr && bin->count < FrameCache::binFrames) {
+                    bin->frames[bin->count++] = frame;
+                    return;
+                }
+            }
+            ::operator delete(frame);
+        }
+    };
+
+    using Handle = std::coroutine_handle<promise_type>;
+
+    Lookup(Lookup&& other) noexcept:
+            handle_(std::exchange(other.handle_, nullptr)) {
+    }
+
+    Lookup& operator=(Lookup&& other) noexcept {
+        if (this != &other) {
+            if (handle_) handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+
+    ~Lookup() {
+        if (handle_) handle_.destroy();
+    }
+
+    bool done() const noexcept { return handle_.done(); }
+    void resume() const { handle_.resume(); }
+
+    // The value from co_return. Rethrows if the lookup threw instead.
+    R result() const {
+        if (handle_.promise().error) {
+            std::rethrow_exception(handle_.promise().error);
+        }
+        return *handle_.promise().result;
+    }
+
+  private:
+    // Up to binFrames free frames of each of up to binCount sizes.
+    struct FrameCache {
+        static constexpr std::size_t binCount = 4;
+        static constexpr std::size_t binFrames = 64;
+
+        struct Bin {
+            std::size_t size = 0;
+            std::size_t count = 0;
+            void* frames[binFrames];
+        };
+
+        Bin bins[binCount];
+
+        ~FrameCache() {
+            cache_destroyed() = true;
+            for (Bin& bin : bins) {
+                for (std::size_t i = 0; i < bin.count; ++i) {
+                    ::operator delete(bin.frames[i]);
+                }
+            }
+        }
+
+        // The bin for frames of size, taking over an empty bin if none has
+        // that size, or nullptr if every bin holds frames of other sizes.
+        Bin* bin(std::size_t size) noexcept {
+            Bin* empty = nullptr;
+            for (Bin& bin : bins) {
+                if (bin.size == size) return &bin;
+                if (empty == nullptr && bin.count == 0) empty = &bin;
+            }
+            if (empty != nullptr) empty->size = size;
+            return empty;
+        }
+    };
+
+    static FrameCache& frame_cache() noexcept {
+        thread_local FrameCache cache;
+        return cache;
+    }
+
+    // Set when this thread's cache is destroyed. A bool has no destructor,
+    // so it can still be read after the cache is gone.
+    static bool& cache_destroyed() noexcept {
+        thread_local bool destroyed = false;
+        return destroyed;
+    }
+
+    Handle handle_;
+
+    explicit Lookup(Handle handle) noexcept: handle_(handle) {
+    }
+};
+
+// Runs lookup(keys[i]) for every i and stores the result in results[i],
+// keeping up to width lookups in flight at once. Whenever one suspends to
+// wait for memory, the next one is resumed, so with a wide enough batch the
+// core always has several cache misses outstanding rather than one.
+//
+// lookup must return a Lookup<R>. width should be about the number of misses
+// the core can have in flight; 8 to 16 is typical.
+template<class Key, class R, class Function>
+void interleave(std::span<const Key> keys, std::span<R> results,
+                Function lookup, std::size_t width = 16) {
+    if (width == 0) width = 1;
+    using Task = decltype(lookup(keys[0]));
+
+    std::vector<std::pair<Task, std::size_t>> inFlight;
+    inFlight.reserve(width);
+    std::size_t next = 0;
+    for (; next < keys.size() && inFlight.size() < width; ++next) {
+        inFlight.emplace_back(lookup(keys[next]), next);
+    }
+
+    while (!inFlight.empty()) {
+        for (std::size_t slot = 0; slot < inFlight.size();) {
+            auto& [task, position] = inFlight[slot];
+            task.resume();
+            if (!task.done()) {
+                ++slot;
+                continue;
+            }
+            results[position] = task.result();
+            if (next < keys.size()) {
+                task = lookup(keys[next]);
+                position = next++;
+                ++slot;
+            } else {
+                inFlight[slot] = std::move(inFlight.back());
+                inFlight.pop_back();
+            }
+        }
+    }
+}
+
+// Lookups for the index-keyed containers, each returning a pointer to the
+// value found, or nullptr.
+
+template<class Index, class Value, class Allocator>
+Lookup<const Value*> lookup_in(const IndexedVector<Index, Value, Allocator>&
+                                       vector,
+                               Index index) {
+    if (to_position(index) >= vector.size()) co_return nullptr;
+    const Value* value = &vector[index];
+    co_await Prefetch(value, sizeof(Value));
+    co_return value;
+}
+
+// The same branchless search as FlatMap::lower_bound(), prefetching each
+// probe before it is compared.
+template<class Index, class Value>
+Lookup<const Value*> lookup_in(const FlatMap<Index, Value>& map, Index index) {
+    using T = typename Index::Underlying;
+    const T key = static_cast<T>(index);
+    const T* keys = map.keys().data();
+    const T* base = keys;
+    std::size_t length = map.size();
+    if (length == 0) co_return nullptr;
+    while (length > 1) {
+        const std::size_t half = length / 2;
+        co_await Prefetch(base + half);
+        base = base[half] < key ? base + half : base;
+        length -= half;
+    }
+    const std::size_t position = static_cast<std::size_t>(base - keys)
+                                 + (*base < key);
+    if (position == map.size() || keys[position] != key) co_return nullptr;
+    const Value* value = &map.value_at(position);
+    co_await Prefetch(value, sizeof(Value));
+    co_return value;
+}
+
+template<class Index, class Value, std::size_t NodeBytes>
+Lookup<const Value*> lookup_in(const BPlusTree<Index, Value, NodeBytes>& tree,
+                               Index index) {
+    auto cursor = tree.cursor(index);
+    while (cursor.next() != nullptr) {
+        co_await Prefetch(cursor.next(), NodeBytes);
+        cursor.step();
+    }
+    co_return cursor.result();
+}
+
+// Looks up every index in keys in container, interleaved, and stores a
+// pointer to each value found (or nullptr) in results.
+template<class Container, class Index, class Value>
+void interleaved_find(const Container& container, std::span<const Index> keys,
+                      std::span<const Value*> results, std::size_t width = 16) {
+    interleave(keys, results,
+               [&container](Index index) {
+                   return lookup_in(container, index);
+               },
+               width);
+}
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_INTERLEAVE
@@ -0,0 +1,168 @@
+// strong-index-lazy.hpp: index-keyed columns whose values are computed the
+// first time they're needed.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_LAZY
+#define STRONG_INDEX_LAZY
+
+#include "strong-index-containers.hpp"
+
+#include <atomic>
+#include <bit>          // countr_zero, popcount
+#include <cstddef>      // byte, size_t
+#include <cstdint>      // uint64_t
+#include <functional>   // function
+#include <memory>       // unique_ptr
+#include <new>          // launder
+#include <utility>      // move
+
+namespace StrongIndex {
+
+// A LazyColumn<Index, Value> has a value for every index in [0, size()), but
+// only works each one out, by calling compute(index), the first time someone
+// asks for it. Values are stored densely, constructed in place, with a bitmap
+// saying which ones are ready.
+//
+// get() may be called from any number of threads at once. Each value is
+// computed exactly once: if several threads ask for the same index at the
+// same time, one computes it and the rest wait for it. If compute throws, the
+// exception goes to the thread which called it and the next get() tries
+// again.
+//
+// invalidate() and invalidate_all() throw values away so they are computed
+// afresh next time. They must not race with anything else, as references
+// returned by get() would dangle.
+template<class Index, class Value>
+class LazyColumn {
+  public:
+    using Compute = std::function<Value(Index)>;
+
+    LazyColumn(std::size_t size, Compute compute):
+            size_(size),
+            compute_(std::move(compute)),
+            values_(std::make_unique<Slot[]>(size)),
+            ready_(std::make_unique<std::atomic<std::uint64_t>[]>(words())),
+            busy_(std::make_unique<std::atomic<std::uint64_t>[]>(words())) {
+    }
+
+    LazyColumn(const LazyColumn&) = delete;
+    LazyColumn& operator=(const LazyColumn&) = delete;
+
+    ~LazyColumn() {
+        invalidate_all();
+    }
+
+    std::size_t size() const noexcept { return size_; }
+
+    // The value for index, computing it first if need be.
+    const Value& get(Index index) {
+        const std::size_t i = to_position(index);
+        std::atomic<std::uint64_t>& busy = busy_[i / 64];
+        while (true) {
+            if (is_ready(i)) return value(i);
+
+            const std::uint64_t before
+                    = busy.fetch_or(bit(i), std::memory_order_acquire);
+            if ((before & bit(i)) != 0) {
+                // Someone else is computing it; wait until they finish.
+                std::uint64_t word = before;
+                while ((word & bit(i)) != 0) {
+                    busy.wait(word, std::memory_order_acquire);
+                    word = busy.load(std::memory_order_acquire);
+                }
+                continue;
+            }
+
+            // It may have become ready since we last looked.
+            if (!is_ready(i)) {
+                try {
+                    ::new (static_cast<void*>(values_[i].bytes))
+                            Value(compute_(index));
+                } catch (...) {
+                    release(busy, i);
+                    throw;
+                }
+                ready_[i / 64].fetch_or(bit(i), std::memory_order_release);
+            }
+            release(busy, i);
+            return value(i);
+        }
+    }
+
+    const Value& operator[](Index index) { return get(index); }
+
+    // The value if it has already been computed, otherwise nullptr.
+    const Value* peek(Index index) const noexcept {
+        const std::size_t i = to_position(index);
+        return is_ready(i) ? &value(i) : nullptr;
+    }
+
+    bool is_computed(Index index) const noexcept {
+        return is_ready(to_position(index));
+    }
+
+    // The number of values which have been computed.
+    std::size_t computed_count() const noexcept {
+        std::size_t total = 0;
+        for (std::size_t w = 0; w < words(); ++w) {
+            total += std::popcount(ready_[w].load(std::memory_order_relaxed));
+        }
+        return total;
+    }
+
+    // Throws away one value, so that it is recomputed next time.
+    void invalidate(Index index) noexcept {
+        const std::size_t i = to_position(index);
+        if (!is_ready(i)) return;
+        value(i).~Value();
+        ready_[i / 64].fetch_and(~bit(i), std::memory_order_relaxed);
+    }
+
+    void invalidate_all() noexcept {
+        for (std::size_t w = 0; w < words(); ++w) {
+            std::uint64_t word = ready_[w].exchange(0,
+                                                    std::memory_order_acquire);
+            for (; word != 0; word &= word - 1) {
+                value(w * 64 + std::countr_zero(word)).~Value();
+            }
+        }
+    }
+
+  private:
+    struct Slot {
+        alignas(Value) std::byte bytes[sizeof(Value)];
+    };
+
+    std::size_t size_;
+    Compute compute_;
+    std::unique_ptr<Slot[]> values_;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> ready_;
+    // Set while a value is being computed.
+    std::unique_ptr<std::atomic<std::uint64_t>[]> busy_;
+
+    static constexpr std::uint64_t bit(std::size_t i) noexcept {
+        return std::uint64_t(1) << (i % 64);
+    }
+
+    std::size_t words() const noexcept { return (size_ + 63) / 64; }
+
+    bool is_ready(std::size_t i) const noexcept {
+        return (ready_[i / 64].load(std::memory_order_acquire) & bit(i)) != 0;
+    }
+
+    Value& value(std::size_t i) const noexcept {
+        return *std::launder(reinterpret_cast<Value*>(values_[i].bytes));
+    }
+
+    static void release(std::atomic<std::uint64_t>& busy,
+                        std::size_t i) noexcept {
+        busy.fetch_and(~bit(i), std::memory_order_release);
+        busy.notify_all();
+    }
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_LAZY
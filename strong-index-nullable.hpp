@@ -0,0 +1,202 @@
+// strong-index-nullable.hpp: index-keyed columns of optional values, with the
+// values dense and the nulls in a separate validity bitmap.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_NULLABLE
+#define STRONG_INDEX_NULLABLE
+
+#include "strong-index-containers.hpp"
+
+#include <algorithm>    // min
+#include <bit>          // countr_zero
+#include <cstddef>      // size_t
+#include <cstdint>      // uint64_t
+#include <functional>   // invoke
+#include <optional>
+#include <span>
+#include <type_traits>  // is_same_v
+#include <utility>      // move
+#include <vector>
+
+namespace StrongIndex {
+
+// A NullableColumn<Index, Value> is what IndexedVector<Index,
+// std::optional<Value>> would be, without the flag and padding that make an
+// optional<double> take 16 bytes. The values are kept in one dense array and
+// whether each is present in an IndexBitmap, at one bit a row. A null row's
+// slot holds Value().
+//
+// The aggregates work a bitmap word, i.e. 64 rows, at a time: words with no
+// nulls are tight unmasked loops which the compiler can vectorize, words
+// with only nulls are skipped, and only mixed words look at individual bits.
+//
+// values() and validity_words() expose the two buffers as they are, without
+// copying, in the same layout Arrow uses for a primitive array.
+template<class Index, class Value>
+class NullableColumn {
+  private:
+    using T = typename Index::Underlying;
+
+  public:
+    static_assert(!std::is_same_v<Value, bool>,
+                  "A NullableColumn of bool has no contiguous value buffer; "
+                  "use an IndexBitmap for the values instead.");
+
+    NullableColumn() = default;
+
+    // A column of size nulls.
+    explicit NullableColumn(std::size_t size): values_(size), valid_(size) {
+    }
+
+    std::size_t size() const noexcept { return values_.size(); }
+    bool empty() const noexcept { return values_.empty(); }
+
+    void reserve(std::size_t capacity) {
+        values_.reserve(capacity);
+        valid_.reserve(capacity);
+    }
+
+    Index push_back(Value value) { return append(std::move(value), true); }
+    Index push_null() { return append(Value(), false); }
+
+    Index push_back(const std::optional<Value>& value) {
+        return value ? push_back(*value) : push_null();
+    }
+
+    void set(Index index, Value value) {
+        values_[index] = std::move(value);
+        valid_.set(index);
+    }
+
+    void set_null(Index index) {
+        values_[index] = Value();
+        valid_.reset(index);
+    }
+
+    bool is_null(Index index) const noexcept { return !valid_.test(index); }
+
+    std::optional<Value> get(Index index) const {
+        if (is_null(index)) return std::nullopt;
+        return values_[index];
+    }
+
+    // The value at index, or Value() if it's null.
+    const Value& operator[](Index index) const noexcept {
+        return values_[index];
+    }
+
+    // The number of non-null values, and of nulls.
+    std::size_t count() const noexcept { return valid_.count(); }
+    std::size_t null_count() const noexcept { return size() - count(); }
+
+    // The sum of the non-null values, or Value() if there are none.
+    Value sum() const {
+        Value total = Value();
+        for_each_word([&](const Value* run, std::size_t length,
+                          std::uint64_t mask) {
+            if (mask == full(length)) {
+                for (std::size_t i = 0; i < length; ++i) total += run[i];
+            } else {
+                for (std::size_t i = 0; i < length; ++i) {
+                    total += (mask >> i) & 1 ? run[i] : Value();
+                }
+            }
+        });
+        return total;
+    }
+
+    // The smallest and largest non-null values, if there are any.
+    std::optional<Value> min() const {
+        return reduce([](const Value& a, const Value& b) {
+            return b < a ? b : a;
+        });
+    }
+
+    std::optional<Value> max() const {
+        return reduce([](const Value& a, const Value& b) {
+            return a < b ? b : a;
+        });
+    }
+
+    // Calls function(Index, const Value&) on every non-null value, in order.
+    template<class Function>
+    void for_each_valid(Function function) const {
+        valid_.for_each_set([&](Index index) {
+            std::invoke(function, index, values_[index]);
+        });
+    }
+
+    // The buffers themselves: one value per row, and the validity bitmap with
+    // row i in bit i % 64 of word i / 64.
+    std::span<const Value> values() const noexcept {
+        return std::span<const Value>(values_.data(), values_.size());
+    }
+    std::span<const std::uint64_t> validity_words() const noexcept {
+        return valid_.words();
+    }
+    const IndexBitmap<Index>& validity() const noexcept { return valid_; }
+
+  private:
+    IndexedVector<Index, Value> values_;
+    IndexBitmap<Index> valid_;
+
+    // Appends the value before its bit, and takes the value back off if the
+    // bit can't be added, so that a throw leaves the column as it was.
+    Index append(Value value, bool valid) {
+        const std::size_t rows = values_.size();
+        const Index index = values_.push_back(std::move(value));
+        try {
+            valid_.push_back(valid);
+        } catch (...) {
+            values_.resize(rows);
+            throw;
+        }
+        return index;
+    }
+
+    // A mask with the low length bits set.
+    static constexpr std::uint64_t full(std::size_t length) noexcept {
+        return length == 64 ? ~std::uint64_t(0)
+                            : (std::uint64_t(1) << length) - 1;
+    }
+
+    // Calls function(const Value*, length, mask) on each run of up to 64
+    // rows covered by one bitmap word, skipping the words which are all
+    // null.
+    template<class Function>
+    void for_each_word(Function function) const {
+        const std::vector<std::uint64_t>& words = valid_.words();
+        for (std::size_t w = 0; w < words.size(); ++w) {
+            if (words[w] == 0) continue;
+            const std::size_t first = w * 64;
+            function(values_.data() + first,
+                     std::min<std::size_t>(64, size() - first), words[w]);
+        }
+    }
+
+    template<class Combine>
+    std::optional<Value> reduce(Combine combine) const {
+        std::optional<Value> result;
+        for_each_word([&](const Value* run, std::size_t length,
+                          std::uint64_t mask) {
+            Value best = result ? *result : run[std::countr_zero(mask)];
+            if (mask == full(length)) {
+                for (std::size_t i = 0; i < length; ++i) {
+                    best = combine(best, run[i]);
+                }
+            } else {
+                for (; mask != 0; mask &= mask - 1) {
+                    best = combine(best, run[std::countr_zero(mask)]);
+                }
+            }
+            result = best;
+        });
+        return result;
+    }
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_NULLABLE
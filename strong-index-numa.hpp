@@ -0,0 +1,360 @@
+// strong-index-numa.hpp: index-keyed arrays which are split across the NUMA
+// nodes of a machine, and a parallel loop which processes each part of the
+// array on the node holding it.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_NUMA
+#define STRONG_INDEX_NUMA
+
+#include "strong-index-containers.hpp"
+
+#include <cstddef>      // size_t
+#include <exception>    // exception_ptr
+#include <fstream>      // ifstream
+#include <mutex>
+#include <new>          // bad_alloc, operator new
+#include <numeric>      // gcd
+#include <sstream>      // istringstream
+#include <string>
+#include <thread>
+#include <type_traits>  // is_nothrow_default_constructible
+#include <utility>      // exchange, move
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>          // sched_setaffinity
+#include <sys/mman.h>       // mmap
+#include <sys/syscall.h>    // SYS_mbind
+#include <unistd.h>         // sysconf, syscall
+#endif
+
+namespace StrongIndex {
+
+// The NUMA nodes of a machine, each with the CPUs which belong to it. On a
+// machine (or OS) without NUMA there is a single node holding every CPU.
+class NumaTopology {
+  public:
+    struct Node {
+        int id;
+        std::vector<int> cpus;
+    };
+
+    // A single node with all of the machine's CPUs.
+    NumaTopology() {
+        Node node{0, {}};
+        unsigned cpuCount = std::thread::hardware_concurrency();
+        for (unsigned cpu = 0; cpu < (cpuCount > 0 ? cpuCount : 1); ++cpu) {
+            node.cpus.push_back(static_cast<int>(cpu));
+        }
+        nodes_.push_back(std::move(node));
+    }
+
+    // An explicit layout, e.g. to test partitioning on a single-node machine.
+    explicit NumaTopology(std::vector<Node> nodes): nodes_(std::move(nodes)) {
+        if (nodes_.empty()) *this = NumaTopology();
+    }
+
+    // Reads the machine's layout from sysfs, falling back to a single node.
+    static NumaTopology detect() {
+#if defined(__linux__)
+        std::ifstream onlineFile("/sys/devices/system/node/online");
+        std::string online;
+        if (std::getline(onlineFile, online)) {
+            std::vector<Node> nodes;
+            for (int id : parse_cpu_list(online)) {
+                std::ifstream cpuFile("/sys/devices/system/node/node"
+                                      + std::to_string(id) + "/cpulist");
+                std::string cpus;
+                std::getline(cpuFile, cpus);
+                // Memory-only nodes have no CPUs to run workers on.
+                if (!parse_cpu_list(cpus).empty()) {
+                    nodes.push_back(Node{id, parse_cpu_list(cpus)});
+                }
+            }
+            return NumaTopology(std::move(nodes));
+        }
+#endif
+        return NumaTopology();
+    }
+
+    std::size_t size() const noexcept { return nodes_.size(); }
+
+    const Node& operator[](std::size_t position) const noexcept {
+        return nodes_[position];
+    }
+
+    // Parses the kernel's list format, e.g. "0-3,8-11".
+    static std::vector<int> parse_cpu_list(const std::string& list) {
+        std::vector<int> cpus;
+        std::istringstream stream(list);
+        std::string item;
+        while (std::getline(stream, item, ',')) {
+            if (item.empty()) continue;
+            std::size_t dash = item.find('-');
+            try {
+                int first = std::stoi(item.substr(0, dash));
+                int last = dash == std::string::npos
+                           ? first : std::stoi(item.substr(dash + 1));
+                for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+            } catch (std::logic_error&) {
+                // Not something we understand; skip it rather than failing.
+            }
+        }
+        return cpus;
+    }
+
+  private:
+    std::vector<Node> nodes_;
+};
+
+// A fixed-size array whose indices are split into one contiguous partition
+// per NUMA node. Each partition's memory is bound to its node with mbind (if
+// the kernel allows it) and is first touched by threads running on that node,
+// so it ends up local to them either way. parallel_for() then runs each
+// partition on its own node's CPUs, so scans never cross the interconnect.
+//
+// Partition boundaries are rounded to page boundaries. Elements are
+// constructed in parallel, so T must be nothrow default constructible.
+template<class Index, class T>
+class NumaPartitionedArray {
+    static_assert(std::is_nothrow_default_constructible_v<T>
+                  && std::is_nothrow_destructible_v<T>);
+
+  public:
+    explicit NumaPartitionedArray(std::size_t size,
+                                  NumaTopology topology = NumaTopology::detect()):
+            size_(size), topology_(std::move(topology)) {
+        const std::size_t pageSize = page_size();
+        const std::size_t granularity
+                = pageSize / std::gcd(pageSize, sizeof(T));
+        const std::size_t partitions = topology_.size();
+        bounds_.push_back(0);
+        for (std::size_t k = 1; k < partitions; ++k) {
+            std::size_t bound = size_ / partitions * k
+                                + size_ % partitions * k / partitions;
+            bounds_.push_back(bound / granularity * granularity);
+        }
+        bounds_.push_back(size_);
+
+        // If anything fails before every element is constructed, only the
+        // memory is given back: T's destructor can't be run on elements
+        // which may never have been constructed.
+        struct Unmap {
+            NumaPartitionedArray* array;
+            ~Unmap() {
+                if (array != nullptr) array->unmap();
+            }
+        } guard{this};
+        allocate(pageSize);
+        parallel_for([this](IndexRange<Index> range) {
+            for (Index index : range) new (&(*this)[index]) T();
+        });
+        guard.array = nullptr;
+    }
+
+    NumaPartitionedArray(const NumaPartitionedArray&) = delete;
+    NumaPartitionedArray& operator=(const NumaPartitionedArray&) = delete;
+
+    NumaPartitionedArray(NumaPartitionedArray&& other) noexcept:
+            data_(std::exchange(other.data_, nullptr)),
+            size_(std::exchange(other.size_, 0)),
+            mappedBytes_(std::exchange(other.mappedBytes_, 0)),
+            topology_(std::move(other.topology_)),
+            bounds_(std::move(other.bounds_)) {
+    }
+
+    NumaPartitionedArray& operator=(NumaPartitionedArray&& other) noexcept {
+        if (this != &other) {
+            release();
+            data_ = std::exchange(other.data_, nullptr);
+            size_ = std::exchange(other.size_, 0);
+            mappedBytes_ = std::exchange(other.mappedBytes_, 0);
+            topology_ = std::move(other.topology_);
+            bounds_ = std::move(other.bounds_);
+        }
+        return *this;
+    }
+
+    ~NumaPartitionedArray() {
+        release();
+    }
+
+    T& operator[](Index index) noexcept {
+        return data_[to_position(index)];
+    }
+
+    const T& operator[](Index index) const noexcept {
+        return data_[to_position(index)];
+    }
+
+    std::size_t size() const noexcept { return size_; }
+    T* data() noexcept { return data_; }
+    const T* data() const noexcept { return data_; }
+
+    const NumaTopology& topology() const noexcept { return topology_; }
+
+    // There is one partition for each node of the topology.
+    // A moved-from array has none.
+    std::size_t partition_count() const noexcept {
+        return bounds_.empty() ? 0 : bounds_.size() - 1;
+    }
+
+    IndexRange<Index> partition(std::size_t k) const noexcept {
+        return IndexRange<Index>(make_index(bounds_[k]),
+                                 make_index(bounds_[k + 1]));
+    }
+
+    // The partition (and so the node) which holds the given index.
+    std::size_t partition_of(Index index) const noexcept {
+        std::size_t k = 0;
+        while (k + 2 < bounds_.size()
+               && bounds_[k + 1] <= to_position(index)) {
+            ++k;
+        }
+        return k;
+    }
+
+    // Calls function(IndexRange<Index>) on every index in the array, using
+    // workersPerNode threads for each partition. Each thread is pinned to the
+    // CPUs of its partition's node, and handles a contiguous slice of it. If
+    // any call throws, the first exception is rethrown once all threads have
+    // finished.
+    template<class Function>
+    void parallel_for(Function function, std::size_t workersPerNode = 1) const {
+        if (workersPerNode == 0) workersPerNode = 1;
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        std::vector<std::thread> workers;
+        try {
+            for (std::size_t k = 0; k < partition_count(); ++k) {
+                const std::size_t first = bounds_[k];
+                const std::size_t length = bounds_[k + 1] - first;
+                for (std::size_t w = 0; w < workersPerNode; ++w) {
+                    const std::size_t begin = first
+                                              + length * w / workersPerNode;
+                    const std::size_t end
+                            = first + length * (w + 1) / workersPerNode;
+                    if (begin == end) continue;
+                    workers.emplace_back([&, k, begin, end]() {
+                        pin_to(topology_[k]);
+                        try {
+                            function(IndexRange<Index>(make_index(begin),
+                                                       make_index(end)));
+                        } catch (...) {
+                            std::lock_guard<std::mutex> lock(errorMutex);
+                            if (!error) error = std::current_exception();
+                        }
+                    });
+                }
+            }
+        } catch (...) {
+            // A thread couldn't be started. The ones which were still refer
+            // to this frame, so they have to finish first.
+            for (std::thread& worker : workers) worker.join();
+            throw;
+        }
+        for (std::thread& worker : workers) worker.join();
+        if (error) std::rethrow_exception(error);
+    }
+
+  private:
+    T* data_ = nullptr;
+    std::size_t size_;
+    std::size_t mappedBytes_ = 0;
+    NumaTopology topology_;
+    std::vector<std::size_t> bounds_;
+
+    static Index make_index(std::size_t position) noexcept {
+        return Index(static_cast<typename Index::Underlying>(position));
+    }
+
+    static std::size_t page_size() noexcept {
+#if defined(__linux__)
+        long pageSize = sysconf(_SC_PAGESIZE);
+        if (pageSize > 0) return static_cast<std::size_t>(pageSize);
+#endif
+        return 4096;
+    }
+
+    void allocate(std::size_t pageSize) {
+        const std::size_t bytes = size_ * sizeof(T);
+        mappedBytes_ = (bytes + pageSize - 1) / pageSize * pageSize;
+        if (mappedBytes_ == 0) return;
+#if defined(__linux__)
+        void* memory = mmap(nullptr, mappedBytes_, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) throw std::bad_alloc();
+        data_ = static_cast<T*>(memory);
+
+        // Binding is only worth a syscall if there's more than one node. If
+        // it fails (no permission, nonexistent node, kernel without NUMA),
+        // first touch from the pinned workers still places the pages.
+        if (topology_.size() > 1) {
+            for (std::size_t k = 0; k < partition_count(); ++k) {
+                const std::size_t begin = bounds_[k] * sizeof(T);
+                const std::size_t end = k + 1 == partition_count()
+                                        ? mappedBytes_
+                                        : bounds_[k + 1] * sizeof(T);
+                if (begin < end) bind(begin, end - begin, topology_[k].id);
+            }
+        }
+#else
+        data_ = static_cast<T*>(::operator new(mappedBytes_,
+                                               std::align_val_t(alignof(T))));
+#endif
+    }
+
+    void release() noexcept {
+        if (data_ == nullptr) return;
+        for (std::size_t i = 0; i < size_; ++i) data_[i].~T();
+        unmap();
+    }
+
+    // Gives back the memory without destroying the elements.
+    void unmap() noexcept {
+        if (data_ == nullptr) return;
+#if defined(__linux__)
+        munmap(data_, mappedBytes_);
+#else
+        ::operator delete(data_, std::align_val_t(alignof(T)));
+#endif
+        data_ = nullptr;
+    }
+
+#if defined(__linux__)
+    void bind(std::size_t offset, std::size_t length, int node) noexcept {
+#if defined(SYS_mbind)
+        constexpr int preferredPolicy = 1; // MPOL_PREFERRED from numaif.h
+        constexpr std::size_t bitsPerWord = 8 * sizeof(unsigned long);
+        if (node < 0) return;
+        std::vector<unsigned long> mask(node / bitsPerWord + 1, 0);
+        mask[node / bitsPerWord] = 1ul << (node % bitsPerWord);
+        syscall(SYS_mbind, reinterpret_cast<char*>(data_) + offset, length,
+                preferredPolicy, mask.data(), mask.size() * bitsPerWord + 1,
+                0);
+#else
+        (void)offset; (void)length; (void)node;
+#endif
+    }
+#endif
+
+    static void pin_to(const NumaTopology::Node& node) noexcept {
+#if defined(__linux__)
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int cpu : node.cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) CPU_SET(cpu, &cpus);
+        }
+        // If none of these CPUs exist we just run wherever the OS puts us.
+        sched_setaffinity(0, sizeof(cpus), &cpus);
+#else
+        (void)node;
+#endif
+    }
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_NUMA
@@ -0,0 +1,212 @@
+// strong-index-packed-index.hpp: composite indices which pack several typed
+// fields into a single integer.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_PACKED_INDEX
+#define STRONG_INDEX_PACKED_INDEX
+
+#include "strong-index.hpp"
+
+#include <array>
+#include <cstddef>      // size_t
+#include <cstdint>      // uint32_t, uint64_t
+#include <functional>   // hash
+#include <iostream>     // operator<<
+#include <limits>       // numeric_limits
+#include <stdexcept>    // out_of_range
+#include <tuple>        // tuple_element
+#include <type_traits>  // conditional, is_same, is_unsigned
+#include <utility>      // index_sequence
+
+namespace StrongIndex {
+
+// One field of a PackedIndex, Bits wide. Reading the field gives back a
+// Basic<Tag, T>, so Field<struct UserIdTag, 48> holds exactly the same kind
+// of index as StrongIndex::Basic<struct UserIdTag>.
+template<class Tag, unsigned Bits, typename T = std::size_t>
+struct Field {
+    using TagType = Tag;
+    using Index = Basic<Tag, T>;
+    static constexpr unsigned bits = Bits;
+
+    static_assert(std::is_unsigned_v<T>, "Fields must be unsigned.");
+    static_assert(Bits > 0 && Bits <= std::numeric_limits<T>::digits,
+                  "A field must fit in its underlying type.");
+};
+
+// A PackedIndex is an index made up of several smaller indices, e.g.
+//     using RowKey = PackedIndex<struct RowKeyTag,
+//                                Field<struct ShardTag, 10>,
+//                                Field<struct TableTag, 6>,
+//                                Field<struct RowTag, 48>>;
+// which is stored in a single 64-bit word (32 bits if the fields fit). Fields
+// are read and written by tag, and each comes back as its own strong index,
+// so there's no hand-written shifting and a shard can't be mistaken for a
+// row. The first field occupies the most significant bits, so comparing the
+// packed words orders keys by their fields from left to right.
+//
+// Building an index from fields which don't fit in their widths throws
+// std::out_of_range, which is a compile error if it happens in a constant
+// expression.
+template<class Tag, class... Fields>
+class PackedIndex {
+  public:
+    static_assert(sizeof...(Fields) > 0, "A PackedIndex needs fields.");
+
+    static constexpr std::size_t fieldCount = sizeof...(Fields);
+    static constexpr unsigned totalBits = (Fields::bits + ...);
+    static_assert(totalBits <= 64, "The fields must fit into 64 bits.");
+
+    using Underlying = std::conditional_t<totalBits <= 32,
+                                          std::uint32_t, std::uint64_t>;
+
+  private:
+    template<class FieldTag>
+    static constexpr std::size_t position_of() noexcept {
+        constexpr std::size_t matchCount
+                = (std::size_t(std::is_same_v<FieldTag,
+                                              typename Fields::TagType>) + ...);
+        static_assert(matchCount == 1,
+                      "Each tag must belong to exactly one field.");
+        constexpr std::array<bool, fieldCount> matches{
+                std::is_same_v<FieldTag, typename Fields::TagType>...};
+        std::size_t position = 0;
+        while (!matches[position]) ++position;
+        return position;
+    }
+
+  public:
+    template<std::size_t I>
+    using FieldIndex = typename std::tuple_element_t<
+            I, std::tuple<Fields...>>::Index;
+
+    template<class FieldTag>
+    using IndexOf = FieldIndex<position_of<FieldTag>()>;
+
+    constexpr explicit PackedIndex(Underlying packedWord) noexcept:
+            word_(packedWord) {
+    }
+
+    constexpr explicit PackedIndex(typename Fields::Index... fields):
+            word_(pack(std::index_sequence_for<Fields...>(), fields...)) {
+    }
+
+    constexpr PackedIndex& operator=(const Underlying& packedWord) noexcept {
+        word_ = packedWord;
+        return *this;
+    }
+
+    constexpr explicit operator Underlying() const noexcept {
+        return word_;
+    }
+
+    // The field with the given tag (or position), e.g. key.get<ShardTag>().
+    template<class FieldTag>
+    constexpr IndexOf<FieldTag> get() const noexcept {
+        return get<position_of<FieldTag>()>();
+    }
+
+    template<std::size_t I>
+    constexpr FieldIndex<I> get() const noexcept {
+        using T = typename FieldIndex<I>::Underlying;
+        return FieldIndex<I>(static_cast<T>((word_ >> shift(I)) & mask(I)));
+    }
+
+    // A copy of this index with one field replaced.
+    template<class FieldTag>
+    constexpr PackedIndex with(IndexOf<FieldTag> field) const {
+        constexpr std::size_t I = position_of<FieldTag>();
+        return PackedIndex((word_ & ~(mask(I) << shift(I)))
+                           | checked_field<I>(field));
+    }
+
+    constexpr friend bool operator==(const PackedIndex& a,
+                                     const PackedIndex& b) noexcept {
+        return a.word_ == b.word_;
+    }
+
+    constexpr friend bool operator!=(const PackedIndex& a,
+                                     const PackedIndex& b) noexcept {
+        return !(a == b);
+    }
+
+    constexpr friend bool operator<(const PackedIndex& a,
+                                    const PackedIndex& b) noexcept {
+        return a.word_ < b.word_;
+    }
+
+    constexpr friend bool operator>(const PackedIndex& a,
+                                    const PackedIndex& b) noexcept {
+        return b < a;
+    }
+
+    constexpr friend bool operator<=(const PackedIndex& a,
+                                     const PackedIndex& b) noexcept {
+        return !(b < a);
+    }
+
+    constexpr friend bool operator>=(const PackedIndex& a,
+                                     const PackedIndex& b) noexcept {
+        return !(a < b);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const PackedIndex& idx) {
+        return os << idx.word_;
+    }
+
+  private:
+    Underlying word_;
+
+    static constexpr std::array<unsigned, fieldCount> widths{Fields::bits...};
+
+    // Fields are laid out from the most significant bit downwards.
+    static constexpr unsigned shift(std::size_t position) noexcept {
+        unsigned bitsBelow = 0;
+        for (std::size_t i = position + 1; i < fieldCount; ++i) {
+            bitsBelow += widths[i];
+        }
+        return bitsBelow;
+    }
+
+    static constexpr Underlying mask(std::size_t position) noexcept {
+        return widths[position] == std::numeric_limits<Underlying>::digits
+               ? ~Underlying(0)
+               : static_cast<Underlying>(
+                       (Underlying(1) << widths[position]) - 1);
+    }
+
+    template<std::size_t I>
+    static constexpr Underlying checked_field(FieldIndex<I> field) {
+        using T = typename FieldIndex<I>::Underlying;
+        const T value = static_cast<T>(field);
+        if (value > static_cast<T>(mask(I))) {
+            throw std::out_of_range("PackedIndex field does not fit.");
+        }
+        return static_cast<Underlying>(static_cast<Underlying>(value)
+                                       << shift(I));
+    }
+
+    template<std::size_t... I>
+    static constexpr Underlying pack(std::index_sequence<I...>,
+                                     typename Fields::Index... fields) {
+        return (Underlying(0) | ... | checked_field<I>(fields));
+    }
+};
+
+} // namespace StrongIndex
+
+// PackedIndex hashes like its packed word, so it can key unordered containers.
+template<class Tag, class... Fields>
+struct std::hash<StrongIndex::PackedIndex<Tag, Fields...>> {
+    std::size_t operator()(
+            const StrongIndex::PackedIndex<Tag, Fields...>& index)
+            const noexcept {
+        using Underlying
+                = typename StrongIndex::PackedIndex<Tag, Fields...>::Underlying;
+        return std::hash<Underlying>()(static_cast<Underlying>(index));
+    }
+};
+
+#endif // STRONG_INDEX_PACKED_INDEX
@@ -0,0 +1,230 @@
+// strong-index-packed-vector.hpp: a vector of indices which stores each one
+// in only as many bits as it needs.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_PACKED_VECTOR
+#define STRONG_INDEX_PACKED_VECTOR
+
+#include "strong-index.hpp"
+
+#include <bit>          // bit_width, endian
+#include <cstddef>      // size_t
+#include <cstdint>      // uint64_t
+#include <cstring>      // memcpy
+#include <span>
+#include <stdexcept>    // invalid_argument, out_of_range
+#include <string>       // to_string
+#include <type_traits>  // is_integral, is_unsigned
+#include <vector>
+
+namespace StrongIndex {
+
+// A PackedIndexVector<Index, Bits> holds indices using only Bits bits each,
+// e.g. 21 bits for foreign keys into a table of 1.5M rows instead of 64. The
+// width can be fixed at compile time, or if Bits is 0 it is given to the
+// constructor instead; a compile-time width lets the compiler turn every
+// shift and mask into a constant.
+//
+// Each element is read with a single unaligned 64-bit load starting at the
+// byte which holds its first bit, which is why widths are limited to 57 bits.
+// The storage always has a spare word at the end so that load never runs off
+// the end.
+template<class Index, unsigned Bits = 0>
+class PackedIndexVector {
+  private:
+    using T = typename Index::Underlying;
+    static_assert(std::is_integral_v<T> && std::is_unsigned_v<T>,
+                  "PackedIndexVector needs an unsigned underlying type.");
+
+  public:
+    static constexpr unsigned maxBits = 57;
+    static_assert(Bits <= maxBits, "Widths above 57 bits are not supported.");
+
+    // The smallest width which can hold every index up to maxValue.
+    static constexpr unsigned required_bits(T maxValue) noexcept {
+        return maxValue == 0 ? 1 : static_cast<unsigned>(std::bit_width(
+                static_cast<std::uint64_t>(maxValue)));
+    }
+
+    PackedIndexVector() {
+        static_assert(Bits != 0, "A runtime width must be given.");
+    }
+
+    explicit PackedIndexVector(unsigned bits): bits_(bits) {
+        if (bits == 0 || bits > maxBits || (Bits != 0 && bits != Bits)) {
+            throw std::invalid_argument("Unsupported PackedIndexVector width "
+                                        + std::to_string(bits) + '.');
+        }
+    }
+
+    unsigned bits() const noexcept { return Bits != 0 ? Bits : bits_; }
+
+    // The largest underlying value which fits in bits().
+    T max_value() const noexcept {
+        return static_cast<T>(mask());
+    }
+
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    // The memory used by the packed elements themselves.
+    std::size_t bytes() const noexcept {
+        return (size_ * bits() + 7) / 8;
+    }
+
+    void reserve(std::size_t capacity) {
+        if (words_for(capacity) > words_.size()) {
+            words_.resize(words_for(capacity), 0);
+        }
+    }
+
+    // New elements are all Index(0).
+    void resize(std::size_t size) {
+        for (std::size_t i = size; i < size_; ++i) store(i, 0);
+        reserve(size);
+        size_ = size;
+    }
+
+    void clear() noexcept {
+        resize(0);
+    }
+
+    Index operator[](std::size_t position) const noexcept {
+        return Index(static_cast<T>(load(position)));
+    }
+
+    Index at(std::size_t position) const {
+        check_position(position);
+        return (*this)[position];
+    }
+
+    // Throws std::out_of_range if the index doesn't fit in bits().
+    void set(std::size_t position, Index index) {
+        check_position(position);
+        store(position, checked_value(index));
+    }
+
+    // Throws std::out_of_range if the index doesn't fit in bits().
+    void push_back(Index index) {
+        const std::uint64_t value = checked_value(index);
+        if (words_for(size_ + 1) > words_.size()) {
+            words_.resize(2 * words_for(size_ + 1), 0);
+        }
+        store(size_++, value);
+    }
+
+    // Copies out.size() elements starting at first into out. Groups of eight
+    // elements always start on a byte boundary, so they are unpacked eight
+    // at a time with offsets that don't depend on the group, which is easy
+    // for the compiler to unroll and vectorize.
+    void unpack(std::size_t first, std::span<Index> out) const {
+        if (first > size_ || out.size() > size_ - first) {
+            throw std::out_of_range("PackedIndexVector::unpack past the end.");
+        }
+        std::size_t i = 0;
+        for (; i < out.size() && (first + i) % 8 != 0; ++i) {
+            out[i] = (*this)[first + i];
+        }
+
+        const unsigned width = bits();
+        const std::uint64_t valueMask = mask();
+        const unsigned char* groupBytes
+                = bytes_data() + (first + i) / 8 * width;
+        for (; i + 8 <= out.size(); i += 8, groupBytes += width) {
+            for (unsigned j = 0; j < 8; ++j) {
+                const unsigned offset = j * width;
+                std::uint64_t word = load_word(groupBytes + offset / 8);
+                out[i + j] = Index(static_cast<T>(
+                        (word >> (offset % 8)) & valueMask));
+            }
+        }
+
+        for (; i < out.size(); ++i) out[i] = (*this)[first + i];
+    }
+
+  private:
+    std::vector<std::uint64_t> words_;
+    std::size_t size_ = 0;
+    unsigned bits_ = Bits;
+
+    std::uint64_t mask() const noexcept {
+        return (std::uint64_t(1) << bits()) - 1;
+    }
+
+    // Enough words for count elements plus the spare word for loads.
+    std::size_t words_for(std::size_t count) const noexcept {
+        return (count * bits() + 63) / 64 + 1;
+    }
+
+    const unsigned char* bytes_data() const noexcept {
+        return reinterpret_cast<const unsigned char*>(words_.data());
+    }
+
+    unsigned char* bytes_data() noexcept {
+        return reinterpret_cast<unsigned char*>(words_.data());
+    }
+
+    // The packed format is little-endian on every platform.
+    static std::uint64_t swap_bytes(std::uint64_t word) noexcept {
+        std::uint64_t swapped = 0;
+        for (int i = 0; i < 8; ++i, word >>= 8) {
+            swapped = (swapped << 8) | (word & 0xff);
+        }
+        return swapped;
+    }
+
+    static std::uint64_t load_word(const unsigned char* source) noexcept {
+        std::uint64_t word;
+        std::memcpy(&word, source, sizeof(word));
+        if constexpr (std::endian::native == std::endian::big) {
+            word = swap_bytes(word);
+        }
+        return word;
+    }
+
+    static void store_word(unsigned char* destination,
+                           std::uint64_t word) noexcept {
+        if constexpr (std::endian::native == std::endian::big) {
+            word = swap_bytes(word);
+        }
+        std::memcpy(destination, &word, sizeof(word));
+    }
+
+    std::uint64_t load(std::size_t position) const noexcept {
+        const std::size_t bit = position * bits();
+        return (load_word(bytes_data() + bit / 8) >> (bit % 8)) & mask();
+    }
+
+    void store(std::size_t position, std::uint64_t value) noexcept {
+        const std::size_t bit = position * bits();
+        unsigned char* target = bytes_data() + bit / 8;
+        std::uint64_t word = load_word(target);
+        word &= ~(mask() << (bit % 8));
+        word |= value << (bit % 8);
+        store_word(target, word);
+    }
+
+    std::uint64_t checked_value(Index index) const {
+        const auto value = static_cast<std::uint64_t>(static_cast<T>(index));
+        if (value > mask()) {
+            throw std::out_of_range("Index " + std::to_string(value)
+                                    + " does not fit in "
+                                    + std::to_string(bits()) + " bits.");
+        }
+        return value;
+    }
+
+    void check_position(std::size_t position) const {
+        if (position >= size_) {
+            throw std::out_of_range("PackedIndexVector position "
+                                    + std::to_string(position)
+                                    + " is out of range.");
+        }
+    }
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_PACKED_VECTOR
@@ -0,0 +1,468 @@
+// strong-index-pipeline.hpp: multi-stage, multi-threaded pipelines joined by
+// bounded lock-free queues, for ingesting index-keyed records.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_PIPELINE
+#define STRONG_INDEX_PIPELINE
+
+#include <atomic>
+#include <bit>          // bit_ceil
+#include <chrono>
+#include <cstddef>      // byte, nullptr_t, ptrdiff_t, size_t
+#include <cstdint>      // uint64_t
+#include <exception>    // exception_ptr
+#include <functional>   // function, invoke
+#include <memory>       // make_shared, make_unique, shared_ptr, unique_ptr
+#include <mutex>
+#include <new>          // launder
+#include <optional>
+#include <string>
+#include <thread>
+#include <type_traits>  // invoke_result_t, remove_cvref_t
+#include <utility>      // move
+#include <vector>
+
+namespace StrongIndex {
+
+// A BoundedQueue is a fixed-capacity multi-producer, multi-consumer queue
+// which never takes a lock. Each slot carries a sequence number saying
+// whether it is ready to be written or read on the current lap around the
+// ring, so producers and consumers only contend on their own position
+// counter. The capacity is rounded up to a power of two.
+//
+// push() and pop() wait when the queue is full or empty, which is what gives
+// a pipeline its backpressure. They spin and yield for a short while, and
+// then sleep with std::atomic::wait until the other side makes progress, so
+// an idle stage costs no CPU. Successful pushes and pops only pay for a
+// notify when someone is actually asleep. Once close() has been called,
+// pop() drains what's left and then returns nothing.
+template<class T>
+class BoundedQueue {
+  public:
+    explicit BoundedQueue(std::size_t capacity):
+            mask_(std::bit_ceil(capacity < 2 ? 2 : capacity) - 1),
+            cells_(std::make_unique<Cell[]>(mask_ + 1)) {
+        for (std::size_t i = 0; i <= mask_; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    ~BoundedQueue() {
+        while (try_pop()) {}
+    }
+
+    std::size_t capacity() const noexcept { return mask_ + 1; }
+
+    // Adds value unless the queue is full. value is only moved from if it
+    // was added.
+    bool try_push(T& value) {
+        std::size_t position = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells_[position & mask_];
+            const auto lap = static_cast<std::ptrdiff_t>(
+                    cell.sequence.load(std::memory_order_acquire) - position);
+            if (lap == 0) {
+                if (tail_.compare_exchange_weak(position, position + 1,
+                                                std::memory_order_relaxed)) {
+                    ::new (static_cast<void*>(cell.bytes)) T(std::move(value));
+                    cell.sequence.store(position + 1,
+                                        std::memory_order_release);
+                    wake(notEmpty_, consumersWaiting_);
+                    return true;
+                }
+            } else if (lap < 0) {
+                return false;
+            } else {
+                position = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::optional<T> try_pop() {
+        std::size_t position = head_.load(std::memory_order_relaxed);
+        while (true) {
+            Cell& cell = cells_[position & mask_];
+            const auto lap = static_cast<std::ptrdiff_t>(
+                    cell.sequence.load(std::memory_order_acquire)
+                    - (position + 1));
+            if (lap == 0) {
+                if (head_.compare_exchange_weak(position, position + 1,
+                                                std::memory_order_relaxed)) {
+                    T* stored = std::launder(reinterpret_cast<T*>(cell.bytes));
+                    std::optional<T> value(std::move(*stored));
+                    stored->~T();
+                    cell.sequence.store(position + mask_ + 1,
+                                        std::memory_order_release);
+                    wake(notFull_, producersWaiting_);
+                    return value;
+                }
+            } else if (lap < 0) {
+                return std::nullopt;
+            } else {
+                position = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Adds value, waiting for room if the queue is full.
+    void push(T value) {
+        for (unsigned spins = 0; spins < spinLimit; ++spins) {
+            if (try_push(value)) return;
+            backoff(spins);
+        }
+        block(notFull_, producersWaiting_, [&]() { return try_push(value); });
+    }
+
+    // Takes the next value, waiting for one if the queue is empty. Returns
+    // nothing once the queue has been closed and drained.
+    std::optional<T> pop() {
+        for (unsigned spins = 0; spins < spinLimit; ++spins) {
+            if (std::optional<T> value = try_pop()) return value;
+            if (closed_.load(std::memory_order_acquire)) return try_pop();
+            backoff(spins);
+        }
+        std::optional<T> value;
+        block(notEmpty_, consumersWaiting_, [&]() {
+            value = try_pop();
+            return value || closed_.load();
+        });
+        return value ? std::move(value) : try_pop();
+    }
+
+    // Says that nothing more will be pushed, and wakes any sleeping pop().
+    void close() noexcept {
+        closed_.store(true);
+        notEmpty_.fetch_add(1);
+        notEmpty_.notify_all();
+    }
+
+  private:
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        alignas(T) std::byte bytes[sizeof(T)];
+    };
+
+    const std::size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    alignas(64) std::atomic<std::size_t> tail_{0};
+    alignas(64) std::atomic<std::size_t> head_{0};
+    alignas(64) std::atomic<bool> closed_{false};
+    // Bumped to wake sleepers, but only while there are any.
+    alignas(64) std::atomic<std::uint32_t> notEmpty_{0};
+    std::atomic<std::uint32_t> consumersWaiting_{0};
+    alignas(64) std::atomic<std::uint32_t> notFull_{0};
+    std::atomic<std::uint32_t> producersWaiting_{0};
+
+    static constexpr unsigned spinLimit = 128;
+
+    static void backoff(unsigned spins) noexcept {
+        if (spins >= 64) std::this_thread::yield();
+    }
+
+    // Sleeps on signal until ready() returns true. signal is read before
+    // each try, so a wake between the try and the wait isn't lost.
+    template<class Ready>
+    static void block(std::atomic<std::uint32_t>& signal,
+                      std::atomic<std::uint32_t>& waiting, Ready ready) {
+        struct Waiting {
+            std::atomic<std::uint32_t>& count;
+            explicit Waiting(std::atomic<std::uint32_t>& count):
+                    count(count) {
+                count.fetch_add(1);
+                // Pairs with the fence in wake(): either the waker sees this
+                // count, or ready() sees what the waker did.
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+            }
+            ~Waiting() { count.fetch_sub(1); }
+        } registered(waiting);
+        while (true) {
+            const std::uint32_t seen = signal.load();
+            if (ready()) return;
+            signal.wait(seen);
+        }
+    }
+
+    static void wake(std::atomic<std::uint32_t>& signal,
+                     std::atomic<std::uint32_t>& waiting) noexcept {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed) != 0) {
+            signal.fetch_add(1);
+            signal.notify_all();
+        }
+    }
+};
+
+// Counters for one stage of a running Pipeline. Times are summed over all
+// of the stage's threads.
+struct StageMetrics {
+    std::string name;
+    std::size_t threads = 0;
+    // Batches the stage has finished with.
+    std::uint64_t items = 0;
+    // Time spent in the stage's own function.
+    std::chrono::nanoseconds busy{0};
+    // Time spent waiting for the next stage to make room, i.e. how much the
+    // stage is being held back by what comes after it.
+    std::chrono::nanoseconds blocked{0};
+
+    // Batches per second of busy time, per thread.
+    double items_per_second() const noexcept {
+        const double seconds = std::chrono::duration<double>(busy).count();
+        return seconds > 0 ? items / seconds : 0;
+    }
+};
+
+namespace PipelineDetail {
+
+struct Stage {
+    std::string name;
+    std::size_t threads;
+    std::atomic<std::uint64_t> items{0};
+    std::atomic<std::uint64_t> busyNanoseconds{0};
+    std::atomic<std::uint64_t> blockedNanoseconds{0};
+    std::atomic<std::size_t> running{0};
+    // Runs on each of the stage's threads until its input is drained.
+    std::function<void(Stage&)> work;
+    // Called by the last of its threads to finish.
+    std::function<void()> close_output;
+
+    Stage(std::string name, std::size_t threads):
+            name(std::move(name)), threads(threads == 0 ? 1 : threads) {
+    }
+
+    static std::uint64_t since(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - start)
+                .count();
+    }
+};
+
+struct Errors {
+    std::mutex mutex;
+    std::exception_ptr first;
+
+    void record() noexcept {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!first) first = std::current_exception();
+    }
+};
+
+} // namespace PipelineDetail
+
+// A running pipeline which accepts batches of In. See PipelineBuilder.
+template<class In>
+class Pipeline {
+  public:
+    Pipeline(Pipeline&&) = default;
+    Pipeline& operator=(Pipeline&&) = delete;
+
+    ~Pipeline() {
+        if (!workers_.empty()) {
+            try {
+                finish();
+            } catch (...) {
+            }
+        }
+    }
+
+    // Feeds a batch into the first stage, waiting while its queue is full.
+    void push(In batch) { input_->push(std::move(batch)); }
+
+    bool try_push(In& batch) { return input_->try_push(batch); }
+
+    // Closes the input, waits for every stage to drain, and rethrows the
+    // first exception any stage threw, if there was one. Batches which
+    // caused an exception are dropped, and the rest keep flowing.
+    void finish() {
+        input_->close();
+        for (std::thread& worker : workers_) worker.join();
+        workers_.clear();
+        if (errors_->first) std::rethrow_exception(errors_->first);
+    }
+
+    // A snapshot of each stage's counters, in pipeline order. Can be called
+    // while the pipeline is running.
+    std::vector<StageMetrics> metrics() const {
+        std::vector<StageMetrics> result;
+        for (const auto& stage : stages_) {
+            StageMetrics m;
+            m.name = stage->name;
+            m.threads = stage->threads;
+            m.items = stage->items.load(std::memory_order_relaxed);
+            m.busy = std::chrono::nanoseconds(
+                    stage->busyNanoseconds.load(std::memory_order_relaxed));
+            m.blocked = std::chrono::nanoseconds(
+                    stage->blockedNanoseconds.load(std::memory_order_relaxed));
+            result.push_back(std::move(m));
+        }
+        return result;
+    }
+
+  private:
+    template<class, class>
+    friend class PipelineBuilder;
+
+    using Stages = std::vector<std::shared_ptr<PipelineDetail::Stage>>;
+
+    std::shared_ptr<BoundedQueue<In>> input_;
+    Stages stages_;
+    std::shared_ptr<PipelineDetail::Errors> errors_;
+    std::vector<std::thread> workers_;
+
+    Pipeline(std::shared_ptr<BoundedQueue<In>> input, Stages stages,
+             std::shared_ptr<PipelineDetail::Errors> errors):
+            input_(std::move(input)),
+            stages_(std::move(stages)),
+            errors_(std::move(errors)) {
+        try {
+            for (const auto& stage : stages_) {
+                stage->running = stage->threads;
+                for (std::size_t t = 0; t < stage->threads; ++t) {
+                    workers_.emplace_back([stage]() {
+                        stage->work(*stage);
+                        if (stage->running.fetch_sub(1) == 1) {
+                            stage->close_output();
+                        }
+                    });
+                }
+            }
+        } catch (...) {
+            // A thread couldn't be started. Some stage may never see its
+            // last thread finish, so close every queue directly to let the
+            // threads which did start run out of work, then join them.
+            input_->close();
+            for (const auto& stage : stages_) stage->close_output();
+            for (std::thread& worker : workers_) worker.join();
+            throw;
+        }
+    }
+};
+
+// Describes a pipeline which takes batches of In and whose last stage so far
+// produces batches of Out. Each then() adds a stage, run by its own threads,
+// which turns an Out into something else; into() adds the final stage, which
+// consumes batches, and starts everything running:
+//
+//     auto ingest = PipelineBuilder<std::vector<std::string>>()
+//             .then("parse", 2, parse)          // -> std::vector<ExternalId>
+//             .then("translate", 2, translate)  // -> std::vector<UserId>
+//             .into("append", 1, append);
+//
+// Since each stage's function is checked against the previous stage's
+// output, a translate stage which takes ExternalIds can't accidentally be
+// given UserIds. Stages are joined by BoundedQueues of queueCapacity
+// batches, so a slow stage holds back the ones before it instead of letting
+// work pile up in memory.
+template<class In, class Out = In>
+class PipelineBuilder {
+  public:
+    explicit PipelineBuilder(std::size_t queueCapacity = 64):
+            queueCapacity_(queueCapacity),
+            input_(std::make_shared<BoundedQueue<In>>(queueCapacity)),
+            tail_(input_),
+            errors_(std::make_shared<PipelineDetail::Errors>()) {
+        static_assert(std::is_same_v<In, Out>,
+                      "A pipeline starts out producing its own input.");
+    }
+
+    // Adds a stage which calls function(Out) on the given number of
+    // threads, and passes on whatever it returns.
+    template<class Function>
+    auto then(std::string name, std::size_t threads, Function function) && {
+        static_assert(std::is_invocable_v<Function&, Out>,
+                      "This stage can't take the previous stage's output.");
+        using Next = std::remove_cvref_t<std::invoke_result_t<Function&, Out>>;
+        static_assert(!std::is_void_v<Next>,
+                      "Use into() for a stage which produces nothing.");
+
+        auto output = std::make_shared<BoundedQueue<Next>>(queueCapacity_);
+        add_stage(std::move(name), threads, std::move(function), output);
+        PipelineBuilder<In, Next> next(queueCapacity_, input_, output,
+                                       std::move(stages_), errors_);
+        return next;
+    }
+
+    // Adds the final stage, which calls function(Out) on the given number
+    // of threads, and starts the pipeline.
+    template<class Function>
+    Pipeline<In> into(std::string name, std::size_t threads,
+                      Function function) && {
+        static_assert(std::is_invocable_v<Function&, Out>,
+                      "This stage can't take the previous stage's output.");
+        add_stage(std::move(name), threads, std::move(function), nullptr);
+        return Pipeline<In>(std::move(input_), std::move(stages_),
+                            std::move(errors_));
+    }
+
+  private:
+    template<class, class>
+    friend class PipelineBuilder;
+
+    using Stages = std::vector<std::shared_ptr<PipelineDetail::Stage>>;
+
+    std::size_t queueCapacity_;
+    std::shared_ptr<BoundedQueue<In>> input_;
+    std::shared_ptr<BoundedQueue<Out>> tail_;
+    Stages stages_;
+    std::shared_ptr<PipelineDetail::Errors> errors_;
+
+    PipelineBuilder(std::size_t queueCapacity,
+                    std::shared_ptr<BoundedQueue<In>> input,
+                    std::shared_ptr<BoundedQueue<Out>> tail, Stages stages,
+                    std::shared_ptr<PipelineDetail::Errors> errors):
+            queueCapacity_(queueCapacity),
+            input_(std::move(input)),
+            tail_(std::move(tail)),
+            stages_(std::move(stages)),
+            errors_(std::move(errors)) {
+    }
+
+    // output is nullptr for the final stage, and a queue otherwise.
+    template<class Function, class Output>
+    void add_stage(std::string name, std::size_t threads, Function function,
+                   Output output) {
+        using Clock = std::chrono::steady_clock;
+        using PipelineDetail::Stage;
+        constexpr bool isFinal = std::is_same_v<Output, std::nullptr_t>;
+
+        auto stage = std::make_shared<Stage>(std::move(name), threads);
+        stage->work = [input = tail_, output, function, errors = errors_](
+                              Stage& stage) mutable {
+            while (std::optional<Out> batch = input->pop()) {
+                const auto start = Clock::now();
+                try {
+                    if constexpr (isFinal) {
+                        std::invoke(function, std::move(*batch));
+                        stage.busyNanoseconds.fetch_add(
+                                Stage::since(start), std::memory_order_relaxed);
+                    } else {
+                        auto result = std::invoke(function, std::move(*batch));
+                        stage.busyNanoseconds.fetch_add(
+                                Stage::since(start), std::memory_order_relaxed);
+                        const auto blocked = Clock::now();
+                        output->push(std::move(result));
+                        stage.blockedNanoseconds.fetch_add(
+                                Stage::since(blocked),
+                                std::memory_order_relaxed);
+                    }
+                } catch (...) {
+                    errors->record();
+                }
+                stage.items.fetch_add(1, std::memory_order_relaxed);
+            }
+        };
+        stage->close_output = [output]() {
+            if constexpr (!isFinal) output->close();
+        };
+        stages_.push_back(std::move(stage));
+    }
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_PIPELINE
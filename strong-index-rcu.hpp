@@ -0,0 +1,186 @@
+// strong-index-rcu.hpp: a read-mostly pointer to a table which a writer can
+// replace wholesale while readers keep reading, without any locks.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_RCU
+#define STRONG_INDEX_RCU
+
+#include <array>
+#include <atomic>
+#include <cstddef>      // size_t
+#include <cstdint>      // uint64_t
+#include <memory>       // unique_ptr
+#include <stdexcept>    // runtime_error
+#include <utility>      // exchange, move
+#include <vector>
+
+namespace StrongIndex {
+
+// Published<T> holds the current version of something which is rebuilt from
+// time to time, typically a lookup table such as an IndexedVector<UserId, T>.
+// A writer builds the next version off to the side and publish()es it in one
+// atomic step; readers see either the old version or the new one, never a mix.
+//
+// Old versions are reclaimed with epochs. Each reader thread claims a Reader,
+// which owns one of MaxReaders slots. While a reader holds a Guard its slot
+// records the epoch in which it started, and a retired version is only freed
+// once no slot is still in an epoch where it could have been seen. So reading
+// is a store to the reader's own slot and a load of the pointer: no locks and
+// no shared counters, so readers never contend with each other.
+//
+// publish() and reclaim() are for a single writer thread (or must be
+// synchronized with each other). A Reader must only be used by one thread at
+// a time and Guards from the same Reader must not overlap.
+template<class T, std::size_t MaxReaders = 64>
+class Published {
+  public:
+    // A reference to the version which was current when it was created. It
+    // stays valid, and unchanged, until the Guard is destroyed.
+    class Guard {
+      public:
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+        ~Guard() {
+            slot_->store(idle, std::memory_order_release);
+        }
+
+        const T& operator*() const noexcept { return *value_; }
+        const T* operator->() const noexcept { return value_; }
+        const T* get() const noexcept { return value_; }
+
+      private:
+        friend class Published;
+
+        Guard(std::atomic<std::uint64_t>* slot, const T* value) noexcept:
+                slot_(slot), value_(value) {
+        }
+
+        std::atomic<std::uint64_t>* slot_;
+        const T* value_;
+    };
+
+    // A registered reader. Each reading thread should have its own.
+    class Reader {
+      public:
+        Reader(Reader&& other) noexcept:
+                owner_(std::exchange(other.owner_, nullptr)),
+                slot_(other.slot_) {
+        }
+
+        Reader& operator=(Reader&&) = delete;
+
+        ~Reader() {
+            if (owner_ != nullptr) {
+                owner_->claimed_[slot_].store(false,
+                                              std::memory_order_release);
+            }
+        }
+
+        Guard read() const noexcept {
+            std::atomic<std::uint64_t>& slot = owner_->slots_[slot_];
+            slot.store(owner_->epoch_.load(std::memory_order_seq_cst),
+                       std::memory_order_seq_cst);
+            return Guard(&slot,
+                         owner_->current_.load(std::memory_order_seq_cst));
+        }
+
+      private:
+        friend class Published;
+
+        Reader(Published* owner, std::size_t slot) noexcept:
+                owner_(owner), slot_(slot) {
+        }
+
+        Published* owner_;
+        std::size_t slot_;
+    };
+
+    explicit Published(std::unique_ptr<T> initial):
+            current_(initial.release()) {
+    }
+
+    Published(const Published&) = delete;
+    Published& operator=(const Published&) = delete;
+
+    // All Readers must be gone by now.
+    ~Published() {
+        delete current_.load();
+    }
+
+    // Claims a reader slot. Throws std::runtime_error if all MaxReaders are
+    // in use.
+    Reader reader() {
+        for (std::size_t i = 0; i < MaxReaders; ++i) {
+            bool expected = false;
+            if (claimed_[i].compare_exchange_strong(expected, true)) {
+                return Reader(this, i);
+            }
+        }
+        throw std::runtime_error("All Published reader slots are in use.");
+    }
+
+    // The current version, for the writer thread, which never needs a Guard.
+    const T& current() const noexcept {
+        return *current_.load(std::memory_order_acquire);
+    }
+
+    // Makes next the current version. The old one is retired and freed once
+    // no reader can still be using it; reclaim() is attempted straight away.
+    void publish(std::unique_ptr<T> next) {
+        T* old = current_.exchange(next.release(), std::memory_order_seq_cst);
+        const std::uint64_t retiredIn
+                = epoch_.fetch_add(1, std::memory_order_seq_cst);
+        retired_.emplace_back(retiredIn, std::unique_ptr<T>(old));
+        reclaim();
+    }
+
+    // Copies the current version, lets update modify the copy, then
+    // publishes it.
+    template<class Function>
+    void update(Function update) {
+        auto next = std::make_unique<T>(current());
+        update(*next);
+        publish(std::move(next));
+    }
+
+    // Frees every retired version which no reader can still see, and
+    // returns how many there were.
+    std::size_t reclaim() {
+        std::uint64_t oldestActive = epoch_.load(std::memory_order_seq_cst);
+        for (const auto& slot : slots_) {
+            const std::uint64_t epoch = slot.load(std::memory_order_seq_cst);
+            if (epoch != idle && epoch < oldestActive) oldestActive = epoch;
+        }
+
+        std::size_t freed = 0;
+        for (std::size_t i = 0; i < retired_.size();) {
+            if (retired_[i].first < oldestActive) {
+                retired_[i] = std::move(retired_.back());
+                retired_.pop_back();
+                ++freed;
+            } else {
+                ++i;
+            }
+        }
+        return freed;
+    }
+
+    // Versions which have been replaced but not yet freed.
+    std::size_t retired_count() const noexcept { return retired_.size(); }
+
+  private:
+    static constexpr std::uint64_t idle = 0;
+
+    std::atomic<T*> current_;
+    std::atomic<std::uint64_t> epoch_{1};
+    std::array<std::atomic<std::uint64_t>, MaxReaders> slots_{};
+    std::array<std::atomic<bool>, MaxReaders> claimed_{};
+    std::vector<std::pair<std::uint64_t, std::unique_ptr<T>>> retired_;
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_RCU
@@ -0,0 +1,227 @@
+// strong-index-rolling.hpp: the most recent events for every index, kept in
+// fixed-size rings inside one contiguous arena.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_ROLLING
+#define STRONG_INDEX_ROLLING
+
+#include "strong-index-containers.hpp"
+
+#include <algorithm>    // min, stable_sort
+#include <bit>          // bit_ceil
+#include <cstddef>      // size_t
+#include <cstdint>      // uint32_t, uint64_t
+#include <functional>   // invoke
+#include <optional>
+#include <span>
+#include <utility>      // move, pair
+#include <vector>
+
+namespace StrongIndex {
+
+// RollingWindows<Index, Value> remembers the last capacity() events, each a
+// timestamp and a value, for every index in [0, size()). Instead of a deque
+// per index, all the rings live in two big arrays, one of timestamps and one
+// of values, with index i's ring at [i * capacity(), (i + 1) * capacity()).
+// That's one allocation in total, and the values of a ring are contiguous,
+// so window aggregates are tight loops over at most two runs of memory which
+// the compiler can vectorize.
+//
+// The capacity is rounded up to a power of two.
+template<class Index, class Value>
+class RollingWindows {
+  public:
+    struct Event {
+        Index index;
+        std::uint64_t timestamp;
+        Value value;
+    };
+
+    RollingWindows(std::size_t size, std::size_t capacity):
+            capacity_(std::bit_ceil(capacity == 0 ? 1 : capacity)),
+            timestamps_(size * capacity_),
+            values_(size * capacity_),
+            next_(size, 0),
+            counts_(size, 0) {
+    }
+
+    // The number of indices.
+    std::size_t size() const noexcept { return next_.size(); }
+    // The number of events kept per index.
+    std::size_t capacity() const noexcept { return capacity_; }
+
+    // The number of events held for index, at most capacity().
+    std::size_t count(Index index) const noexcept { return counts_[index]; }
+
+    // Records an event, pushing out the oldest if the ring is full.
+    void push(Index index, std::uint64_t timestamp, Value value) {
+        const std::size_t slot = base(index) + next_[index];
+        timestamps_[slot] = timestamp;
+        values_[slot] = std::move(value);
+        next_[index] = static_cast<std::uint32_t>((next_[index] + 1)
+                                                  & (capacity_ - 1));
+        if (counts_[index] < capacity_) ++counts_[index];
+    }
+
+    // Records a batch of events for any indices, in any order. Each index's
+    // events are appended in timestamp order (ties keep their order in the
+    // batch), and only the newest capacity() of them are written at all.
+    void append(std::span<const Event> events) {
+        std::vector<std::uint32_t> order = sorted_by_index(events);
+        for (std::size_t first = 0; first < order.size();) {
+            const Index index = events[order[first]].index;
+            std::size_t last = first + 1;
+            while (last < order.size()
+                   && events[order[last]].index == index) {
+                ++last;
+            }
+            std::stable_sort(order.begin() + first, order.begin() + last,
+                             [&](std::uint32_t a, std::uint32_t b) {
+                                 return events[a].timestamp
+                                        < events[b].timestamp;
+                             });
+            const std::size_t skip = last - first > capacity_
+                                     ? last - first - capacity_
+                                     : 0;
+            for (std::size_t e = first + skip; e < last; ++e) {
+                const Event& event = events[order[e]];
+                push(index, event.timestamp, event.value);
+            }
+            first = last;
+        }
+    }
+
+    // The event age places before the newest, so age 0 is the newest. age
+    // must be less than count(index).
+    std::pair<std::uint64_t, Value> at(Index index,
+                                       std::size_t age) const noexcept {
+        const std::size_t slot = base(index) + position(index, age);
+        return {timestamps_[slot], values_[slot]};
+    }
+
+    // Calls function(timestamp, value) on each event held for index, oldest
+    // first.
+    template<class Function>
+    void for_each(Index index, Function function) const {
+        for (std::size_t age = count(index); age-- > 0;) {
+            const std::size_t slot = base(index) + position(index, age);
+            std::invoke(function, timestamps_[slot], values_[slot]);
+        }
+    }
+
+    void clear(Index index) noexcept {
+        next_[index] = 0;
+        counts_[index] = 0;
+    }
+
+    // Aggregates over the newest k values for index (or all of them, if
+    // there are fewer than k).
+    Value window_sum(Index index, std::size_t k) const {
+        Value total = Value();
+        for_window(index, k, [&total](const Value* run, std::size_t length) {
+            for (std::size_t i = 0; i < length; ++i) total += run[i];
+        });
+        return total;
+    }
+
+    std::optional<Value> window_min(Index index, std::size_t k) const {
+        return reduce(index, k, [](Value a, Value b) { return b < a ? b : a; });
+    }
+
+    std::optional<Value> window_max(Index index, std::size_t k) const {
+        return reduce(index, k, [](Value a, Value b) { return a < b ? b : a; });
+    }
+
+    // The raw arenas, ring by ring, e.g. for handing to other code.
+    std::span<const std::uint64_t> timestamps() const noexcept {
+        return timestamps_;
+    }
+    std::span<const Value> values() const noexcept { return values_; }
+
+  private:
+    std::size_t capacity_;
+    std::vector<std::uint64_t> timestamps_;
+    std::vector<Value> values_;
+    // Where each ring's next event goes, and how many it holds.
+    IndexedVector<Index, std::uint32_t> next_;
+    IndexedVector<Index, std::uint32_t> counts_;
+
+    std::size_t base(Index index) const noexcept {
+        return to_position(index) * capacity_;
+    }
+
+    // The slot within index's ring of the event age places before the
+    // newest.
+    std::size_t position(Index index, std::size_t age) const noexcept {
+        return (next_[index] + capacity_ - 1 - age) & (capacity_ - 1);
+    }
+
+    // Calls function(const Value*, length) on the one or two contiguous runs
+    // making up the newest k values.
+    template<class Function>
+    void for_window(Index index, std::size_t k, Function function) const {
+        k = std::min<std::size_t>(k, counts_[index]);
+        const Value* ring = values_.data() + base(index);
+        const std::size_t end = next_[index];
+        if (k <= end) {
+            function(ring + end - k, k);
+        } else {
+            function(ring + capacity_ - (k - end), k - end);
+            function(ring, end);
+        }
+    }
+
+    template<class Combine>
+    std::optional<Value> reduce(Index index, std::size_t k,
+                                Combine combine) const {
+        if (k == 0 || counts_[index] == 0) return std::nullopt;
+        std::optional<Value> result;
+        for_window(index, k, [&](const Value* run, std::size_t length) {
+            if (length == 0) return;
+            Value best = result ? *result : run[0];
+            for (std::size_t i = 0; i < length; ++i) {
+                best = combine(best, run[i]);
+            }
+            result = best;
+        });
+        return result;
+    }
+
+    // The positions of events, ordered by index. Counting sort when the
+    // batch is big compared to the number of indices, comparison sort when
+    // it's small.
+    std::vector<std::uint32_t> sorted_by_index(
+            std::span<const Event> events) const {
+        std::vector<std::uint32_t> order(events.size());
+        if (events.size() * 16 < size()) {
+            for (std::size_t e = 0; e < events.size(); ++e) {
+                order[e] = static_cast<std::uint32_t>(e);
+            }
+            std::stable_sort(order.begin(), order.end(),
+                             [&](std::uint32_t a, std::uint32_t b) {
+                                 return to_position(events[a].index)
+                                        < to_position(events[b].index);
+                             });
+            return order;
+        }
+
+        std::vector<std::uint32_t> starts(size() + 1, 0);
+        for (const Event& event : events) {
+            ++starts[to_position(event.index) + 1];
+        }
+        for (std::size_t i = 1; i < starts.size(); ++i) {
+            starts[i] += starts[i - 1];
+        }
+        for (std::size_t e = 0; e < events.size(); ++e) {
+            order[starts[to_position(events[e].index)]++]
+                    = static_cast<std::uint32_t>(e);
+        }
+        return order;
+    }
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_ROLLING
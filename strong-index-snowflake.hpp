@@ -0,0 +1,124 @@
+// strong-index-snowflake.hpp: time-ordered unique IDs, made of a timestamp, a
+// worker number and a sequence number, generated without locks.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_SNOWFLAKE
+#define STRONG_INDEX_SNOWFLAKE
+
+#include "strong-index-packed-index.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>      // uint64_t
+#include <stdexcept>    // overflow_error
+
+namespace StrongIndex {
+
+// The components of a SnowflakeId, each of which is its own kind of index.
+// Timestamps count milliseconds since the generator's epoch.
+using SnowflakeTimestamp = Basic<struct SnowflakeTimestampTag, std::uint64_t>;
+using SnowflakeWorker = Basic<struct SnowflakeWorkerTag, std::uint64_t>;
+using SnowflakeSequence = Basic<struct SnowflakeSequenceTag, std::uint64_t>;
+
+// A SnowflakeId is a PackedIndex of a timestamp, a worker number and a
+// sequence number, in that order, so IDs sort by the time they were created.
+// The defaults are the classic 41/10/12 split: 69 years of milliseconds, 1024
+// workers and 4096 IDs per worker per millisecond. Components are read with
+// e.g. id.get<SnowflakeTimestampTag>().
+template<class Tag, unsigned TimestampBits = 41, unsigned WorkerBits = 10,
+         unsigned SequenceBits = 12>
+using SnowflakeId = PackedIndex<
+        Tag,
+        Field<SnowflakeTimestampTag, TimestampBits, std::uint64_t>,
+        Field<SnowflakeWorkerTag, WorkerBits, std::uint64_t>,
+        Field<SnowflakeSequenceTag, SequenceBits, std::uint64_t>>;
+
+template<class Id, class Clock = std::chrono::system_clock>
+class SnowflakeGenerator;
+
+// A SnowflakeGenerator hands out strictly increasing SnowflakeIds for one
+// worker number. next() is lock-free: the last timestamp and sequence number
+// live in a single atomic word which is advanced by compare-and-swap, so it
+// can be shared between threads, though giving each thread its own generator
+// (and worker number) avoids even that contention.
+//
+// IDs never go backwards, even if the clock does: the generator keeps using
+// its last timestamp until the clock catches up. If a millisecond's sequence
+// numbers run out, the generator borrows the next millisecond rather than
+// waiting for it.
+//
+// There is no default epoch: the clock's own is usually 1970, which with 41
+// bits of milliseconds runs out in 2039. Pick a fixed, recent one, such as
+// when the system was first deployed, and never change it. next() throws
+// std::overflow_error once the timestamp bits run out.
+template<class Tag, unsigned TimestampBits, unsigned WorkerBits,
+         unsigned SequenceBits, class Clock>
+class SnowflakeGenerator<SnowflakeId<Tag, TimestampBits, WorkerBits,
+                                     SequenceBits>, Clock> {
+  public:
+    using Id = SnowflakeId<Tag, TimestampBits, WorkerBits, SequenceBits>;
+
+    // Throws std::out_of_range if the worker doesn't fit in WorkerBits.
+    SnowflakeGenerator(SnowflakeWorker worker,
+                       typename Clock::time_point epoch):
+            worker_(Id(SnowflakeTimestamp(0), worker, SnowflakeSequence(0))
+                    .template get<SnowflakeWorkerTag>()),
+            epoch_(epoch) {
+    }
+
+    SnowflakeGenerator(const SnowflakeGenerator&) = delete;
+    SnowflakeGenerator& operator=(const SnowflakeGenerator&) = delete;
+
+    SnowflakeWorker worker() const noexcept { return worker_; }
+
+    Id next() {
+        const std::uint64_t now = millis_since_epoch();
+        std::uint64_t last = state_.load(std::memory_order_relaxed);
+        std::uint64_t state;
+        do {
+            // Adding one to the sequence carries into the timestamp when the
+            // sequence is exhausted.
+            state = now > (last >> SequenceBits) ? now << SequenceBits
+                                                  : last + 1;
+        } while (!state_.compare_exchange_weak(last, state,
+                                               std::memory_order_relaxed));
+
+        const std::uint64_t timestamp = state >> SequenceBits;
+        if (timestamp > maxTimestamp) {
+            throw std::overflow_error("SnowflakeGenerator ran out of "
+                                      "timestamp bits.");
+        }
+        return Id(SnowflakeTimestamp(timestamp), worker_,
+                  SnowflakeSequence(state & sequenceMask));
+    }
+
+    // The time at which an ID was generated, to the millisecond.
+    typename Clock::time_point time_of(Id id) const {
+        const auto millis = static_cast<std::uint64_t>(
+                id.template get<SnowflakeTimestampTag>());
+        return epoch_ + std::chrono::duration_cast<typename Clock::duration>(
+                std::chrono::milliseconds(millis));
+    }
+
+  private:
+    static constexpr std::uint64_t sequenceMask
+            = (std::uint64_t(1) << SequenceBits) - 1;
+    static constexpr std::uint64_t maxTimestamp
+            = (std::uint64_t(1) << TimestampBits) - 1;
+
+    SnowflakeWorker worker_;
+    typename Clock::time_point epoch_;
+    std::atomic<std::uint64_t> state_{0};
+
+    std::uint64_t millis_since_epoch() const {
+        const auto elapsed = std::chrono::duration_cast<
+                std::chrono::milliseconds>(Clock::now() - epoch_).count();
+        return elapsed > 0 ? static_cast<std::uint64_t>(elapsed) : 0;
+    }
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_SNOWFLAKE
@@ -0,0 +1,171 @@
+// strong-index-stable-vector.hpp: a vector whose indices stay valid when
+// elements are erased, with explicit compaction.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_STABLE_VECTOR
+#define STRONG_INDEX_STABLE_VECTOR
+
+#include "strong-index-containers.hpp"
+
+#include <cstddef>      // size_t
+#include <functional>   // invoke
+#include <optional>
+#include <span>
+#include <utility>      // move
+#include <vector>
+
+namespace StrongIndex {
+
+// The result of compacting a StableVector: where each old index ended up.
+// Use it to update foreign-key columns which refer to the compacted vector.
+template<class Index>
+class IndexRemap {
+  private:
+    using T = typename Index::Underlying;
+
+  public:
+    explicit IndexRemap(std::size_t oldSize): newPositions_(oldSize),
+                                              kept_(oldSize) {
+    }
+
+    // The number of indices before compaction.
+    std::size_t size() const noexcept { return newPositions_.size(); }
+
+    // The new index for an old one, or nothing if it was erased. Indices
+    // which were never in the vector, like the orphan value written by an
+    // earlier apply(), count as erased.
+    std::optional<Index> operator()(Index oldIndex) const noexcept {
+        if (!kept(oldIndex)) return std::nullopt;
+        return Index(newPositions_[oldIndex]);
+    }
+
+    // Rewrites every index in column to its new value. Indices of erased
+    // elements are replaced with orphan; returns how many there were.
+    std::size_t apply(std::span<Index> column, Index orphan) const noexcept {
+        std::size_t orphans = 0;
+        for (Index& index : column) {
+            const bool kept = this->kept(index);
+            index = kept ? Index(newPositions_[index]) : orphan;
+            orphans += !kept;
+        }
+        return orphans;
+    }
+
+  private:
+    template<class, class>
+    friend class StableVector;
+
+    IndexedVector<Index, T> newPositions_;
+    IndexBitmap<Index> kept_;
+
+    bool kept(Index oldIndex) const noexcept {
+        return to_position(oldIndex) < newPositions_.size()
+               && kept_.test(oldIndex);
+    }
+
+    void map(Index oldIndex, Index newIndex) noexcept {
+        newPositions_[oldIndex] = static_cast<T>(newIndex);
+        kept_.set(oldIndex);
+    }
+};
+
+// A StableVector is an index-keyed vector where erasing an element doesn't
+// shift the ones after it, so indices held elsewhere stay valid. Erased
+// elements are marked in a bitmap of live slots (and reset to Value()), and
+// iteration skips them a whole 64-bit word at a time, so it stays fast even
+// after heavy churn.
+//
+// The space taken up by erased elements is only reclaimed by compact(), which
+// renumbers the remaining elements and returns an IndexRemap describing the
+// change, so that remapping references is always an explicit step.
+template<class Index, class Value>
+class StableVector {
+  private:
+    using T = typename Index::Underlying;
+
+  public:
+    StableVector() = default;
+
+    // The number of live elements.
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    // The number of slots, live or erased; every live index is below this.
+    std::size_t slot_count() const noexcept { return values_.size(); }
+
+    std::size_t tombstone_count() const noexcept {
+        return values_.size() - size_;
+    }
+
+    void reserve(std::size_t capacity) { values_.reserve(capacity); }
+
+    Index push_back(Value value) {
+        Index index = values_.push_back(std::move(value));
+        live_.push_back(true);
+        ++size_;
+        return index;
+    }
+
+    // Whether index refers to a live element.
+    bool contains(Index index) const noexcept {
+        return to_position(index) < values_.size() && live_.test(index);
+    }
+
+    Value& operator[](Index index) noexcept { return values_[index]; }
+    const Value& operator[](Index index) const noexcept {
+        return values_[index];
+    }
+
+    // Erases a live element. Returns false if it wasn't live.
+    bool erase(Index index) {
+        if (!contains(index)) return false;
+        live_.reset(index);
+        values_[index] = Value();
+        --size_;
+        return true;
+    }
+
+    // Calls function(Index, Value&) on each live element, in order.
+    template<class Function>
+    void for_each(Function function) {
+        live_.for_each_set([&](Index index) {
+            std::invoke(function, index, values_[index]);
+        });
+    }
+
+    template<class Function>
+    void for_each(Function function) const {
+        live_.for_each_set([&](Index index) {
+            std::invoke(function, index, values_[index]);
+        });
+    }
+
+    // Moves the live elements to the front, keeping their order, and frees
+    // the erased slots. Every index changes meaning, so the returned remap
+    // should be applied to anything which refers into this vector.
+    IndexRemap<Index> compact() {
+        IndexRemap<Index> remap(values_.size());
+        T next = T();
+        live_.for_each_set([&](Index index) {
+            const Index newIndex(next++);
+            if (newIndex != index) {
+                values_[newIndex] = std::move(values_[index]);
+            }
+            remap.map(index, newIndex);
+        });
+        values_.resize(size_);
+        live_ = IndexBitmap<Index>(size_, true);
+        return remap;
+    }
+
+  private:
+    IndexedVector<Index, Value> values_;
+    IndexBitmap<Index> live_;
+    std::size_t size_ = 0;
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_STABLE_VECTOR
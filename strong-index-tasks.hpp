@@ -0,0 +1,306 @@
+// strong-index-tasks.hpp: graphs of tasks with dependencies, run in
+// parallel on a work-stealing thread pool.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_TASKS
+#define STRONG_INDEX_TASKS
+
+#include "strong-index.hpp"
+#include "strong-index-containers.hpp"
+
+#include <atomic>
+#include <cstddef>      // size_t
+#include <cstdint>      // uint32_t
+#include <deque>
+#include <exception>    // exception_ptr
+#include <functional>   // function
+#include <initializer_list>
+#include <memory>       // make_unique, unique_ptr
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>    // invalid_argument
+#include <thread>
+#include <utility>      // move, pair
+#include <vector>
+
+namespace StrongIndex {
+
+struct TaskIdTag {};
+using TaskId = Incrementable<TaskIdTag, std::uint32_t>;
+
+// A TaskGraph is a set of tasks, each identified by a TaskId, where some
+// tasks have to wait for others to finish before they can start. Once the
+// graph is built, run() executes it on a pool of threads, starting each task
+// as soon as everything it depends on is done.
+//
+// Each thread has its own deque of ready tasks. It pushes the tasks it makes
+// ready onto the back and takes its next task from the back too, so a chain
+// of dependent tasks tends to stay on one thread with its data still in
+// cache. A thread which runs out of work steals from the front of someone
+// else's deque, taking the task which has been waiting longest. A thread
+// which finds nothing to steal sleeps until another makes a task ready.
+//
+// The edges are stored as a compressed sparse row: the dependents of every
+// task in one array, in order of TaskId, and the offset of each task's
+// dependents in another.
+class TaskGraph {
+  public:
+    TaskGraph() = default;
+
+    std::size_t size() const noexcept { return work_.size(); }
+
+    // Adds a task which will run after all of prerequisites have finished.
+    // Throws std::invalid_argument, without adding anything, if one of them
+    // doesn't exist.
+    TaskId add(std::function<void()> work,
+               std::initializer_list<TaskId> prerequisites = {}) {
+        for (TaskId prerequisite : prerequisites) {
+            if (to_position(prerequisite) >= size()) {
+                throw std::invalid_argument("No such task.");
+            }
+        }
+        const TaskId task = work_.push_back(std::move(work));
+        built_ = false;
+        for (TaskId prerequisite : prerequisites) {
+            add_dependency(task, prerequisite);
+        }
+        return task;
+    }
+
+    // Makes task wait for prerequisite to finish.
+    void add_dependency(TaskId task, TaskId prerequisite) {
+        if (to_position(task) >= size()
+            || to_position(prerequisite) >= size()) {
+            throw std::invalid_argument("No such task.");
+        }
+        edges_.emplace_back(prerequisite, task);
+        built_ = false;
+    }
+
+    // The tasks which wait for task.
+    std::span<const TaskId> dependents(TaskId task) {
+        build();
+        return dependents_of(task);
+    }
+
+    // Runs every task once, using the given number of threads, and returns
+    // when they have all finished. Throws std::invalid_argument if the
+    // dependencies have a cycle. If a task throws, no more tasks are
+    // started, and the first exception is rethrown at the end.
+    void run(std::size_t threads = std::thread::hardware_concurrency()) {
+        build();
+        const std::size_t taskCount = size();
+        if (taskCount == 0) return;
+        if (threads == 0) threads = 1;
+
+        auto waitingFor = std::make_unique<std::atomic<std::uint32_t>[]>(
+                taskCount);
+        for (TaskId task : work_.indices()) {
+            waitingFor[to_position(task)] = prerequisiteCount_[task];
+        }
+
+        Run state{std::make_unique<Worker[]>(threads), threads, taskCount};
+        std::size_t next = 0;
+        for (TaskId task : work_.indices()) {
+            if (prerequisiteCount_[task] == 0) {
+                state.workers[next++ % threads].tasks.push_back(task);
+            }
+        }
+        state.queued = next;
+
+        std::vector<std::thread> pool;
+        try {
+            for (std::size_t w = 0; w < threads; ++w) {
+                pool.emplace_back([&, w]() {
+                    while (state.unfinished.load() != 0) {
+                        std::optional<TaskId> task = state.take(w);
+                        if (!task) {
+                            state.wait_for_work();
+                            continue;
+                        }
+                        execute(*task, w, state, waitingFor.get());
+                    }
+                });
+            }
+        } catch (...) {
+            // A thread couldn't be started. The ones which were steal
+            // everything between them, so they can still finish the run,
+            // but they refer to this frame and have to be joined first.
+            for (std::thread& thread : pool) thread.join();
+            throw;
+        }
+        for (std::thread& thread : pool) thread.join();
+        if (state.error) std::rethrow_exception(state.error);
+    }
+
+  private:
+    struct alignas(64) Worker {
+        std::mutex mutex;
+        std::deque<TaskId> tasks;
+    };
+
+    struct Run {
+        std::unique_ptr<Worker[]> workers;
+        std::size_t workerCount;
+        std::atomic<std::size_t> unfinished;
+        std::atomic<bool> failed{false};
+        std::mutex errorMutex;
+        std::exception_ptr error;
+        // Tasks sitting in some deque.
+        std::atomic<std::size_t> queued{0};
+        // Bumped to wake sleeping workers, but only while there are any.
+        std::atomic<std::uint32_t> signal{0};
+        std::atomic<std::uint32_t> sleeping{0};
+
+        Run(std::unique_ptr<Worker[]> workers, std::size_t workerCount,
+            std::size_t taskCount):
+                workers(std::move(workers)),
+                workerCount(workerCount),
+                unfinished(taskCount) {
+        }
+
+        // The newest task from worker w's own deque, or failing that the
+        // oldest from someone else's.
+        std::optional<TaskId> take(std::size_t w) {
+            {
+                Worker& own = workers[w];
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if (!own.tasks.empty()) {
+                    const TaskId task = own.tasks.back();
+                    own.tasks.pop_back();
+                    queued.fetch_sub(1);
+                    return task;
+                }
+            }
+            for (std::size_t i = 1; i < workerCount; ++i) {
+                Worker& victim = workers[(w + i) % workerCount];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.tasks.empty()) {
+                    const TaskId task = victim.tasks.front();
+                    victim.tasks.pop_front();
+                    queued.fetch_sub(1);
+                    return task;
+                }
+            }
+            return std::nullopt;
+        }
+
+        // Sleeps until a task is queued or the run is over. signal is read
+        // before checking, so a wake() in between isn't lost.
+        void wait_for_work() {
+            sleeping.fetch_add(1);
+            // Pairs with the fence in wake(): either the waker sees this
+            // sleeper, or the checks below see what the waker did.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const std::uint32_t seen = signal.load();
+            if (queued.load() == 0 && unfinished.load() != 0) {
+                signal.wait(seen);
+            }
+            sleeping.fetch_sub(1);
+        }
+
+        void wake() noexcept {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (sleeping.load(std::memory_order_relaxed) != 0) {
+                signal.fetch_add(1);
+                signal.notify_all();
+            }
+        }
+    };
+
+    IndexedVector<TaskId, std::function<void()>> work_;
+    // (prerequisite, task) pairs, in the order they were added.
+    std::vector<std::pair<TaskId, TaskId>> edges_;
+
+    // Built from edges_ by build().
+    bool built_ = false;
+    IndexedVector<TaskId, std::uint32_t> firstDependent_;
+    std::vector<TaskId> dependents_;
+    IndexedVector<TaskId, std::uint32_t> prerequisiteCount_;
+
+    void build() {
+        if (built_) return;
+
+        const std::size_t taskCount = size();
+        firstDependent_ = IndexedVector<TaskId, std::uint32_t>(taskCount + 1,
+                                                                0);
+        prerequisiteCount_ = IndexedVector<TaskId, std::uint32_t>(taskCount,
+                                                                   0);
+        for (const auto& [prerequisite, task] : edges_) {
+            ++firstDependent_[prerequisite + 1];
+            ++prerequisiteCount_[task];
+        }
+        for (std::size_t i = 1; i <= taskCount; ++i) {
+            const TaskId id(static_cast<std::uint32_t>(i));
+            firstDependent_[id] += firstDependent_[id - 1];
+        }
+        dependents_.assign(edges_.size(), TaskId(0));
+        std::vector<std::uint32_t> filled(taskCount, 0);
+        for (const auto& [prerequisite, task] : edges_) {
+            const std::size_t p = to_position(prerequisite);
+            dependents_[firstDependent_[prerequisite] + filled[p]++] = task;
+        }
+        check_for_cycles();
+        built_ = true;
+    }
+
+    std::span<const TaskId> dependents_of(TaskId task) const noexcept {
+        const std::uint32_t first = firstDependent_[task];
+        return std::span<const TaskId>(dependents_.data() + first,
+                                       firstDependent_[task + 1] - first);
+    }
+
+    // Kahn's algorithm: if repeatedly removing tasks with no remaining
+    // prerequisites doesn't remove them all, the rest are in a cycle.
+    void check_for_cycles() const {
+        IndexedVector<TaskId, std::uint32_t> waitingFor = prerequisiteCount_;
+        std::vector<TaskId> ready;
+        for (TaskId task : work_.indices()) {
+            if (waitingFor[task] == 0) ready.push_back(task);
+        }
+        std::size_t removed = 0;
+        while (!ready.empty()) {
+            const TaskId task = ready.back();
+            ready.pop_back();
+            ++removed;
+            for (TaskId dependent : dependents_of(task)) {
+                if (--waitingFor[dependent] == 0) ready.push_back(dependent);
+            }
+        }
+        if (removed != size()) {
+            throw std::invalid_argument("The task graph has a cycle.");
+        }
+    }
+
+    void execute(TaskId task, std::size_t w, Run& state,
+                 std::atomic<std::uint32_t>* waitingFor) {
+        if (!state.failed.load(std::memory_order_relaxed)) {
+            try {
+                work_[task]();
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(state.errorMutex);
+                if (!state.error) state.error = std::current_exception();
+                state.failed = true;
+            }
+        }
+        bool madeReady = false;
+        for (TaskId dependent : dependents_of(task)) {
+            const std::size_t d = to_position(dependent);
+            if (waitingFor[d].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                Worker& own = state.workers[w];
+                std::lock_guard<std::mutex> lock(own.mutex);
+                own.tasks.push_back(dependent);
+                state.queued.fetch_add(1);
+                madeReady = true;
+            }
+        }
+        if (state.unfinished.fetch_sub(1) == 1 || madeReady) state.wake();
+    }
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_TASKS
@@ -0,0 +1,273 @@
+// strong-index-timer-wheel.hpp: a hierarchical timer wheel with one timer per
+// index, for very large numbers of timeouts.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_TIMER_WHEEL
+#define STRONG_INDEX_TIMER_WHEEL
+
+#include "strong-index-containers.hpp"
+
+#include <array>
+#include <bit>          // countr_zero
+#include <cstddef>      // size_t
+#include <cstdint>      // uint32_t, uint64_t
+#include <functional>   // invoke
+#include <limits>       // numeric_limits
+#include <optional>
+#include <utility>      // exchange
+#include <vector>
+
+namespace StrongIndex {
+
+// A TimerWheel keeps at most one timer per index, e.g. a session expiry per
+// UserId, with deadlines measured in ticks of whatever length suits. Setting,
+// replacing and cancelling a timer are all O(1), and advance() hands back
+// every index whose deadline has passed, in deadline order.
+//
+// There are Levels wheels of 64 slots each. Level 0 has a slot per tick,
+// level 1 a slot per 64 ticks, and so on; a timer goes in the finest level
+// whose current lap its deadline falls within, and drops down a level each
+// time the clock reaches its slot. Deadlines beyond the top level wait in an
+// overflow list, which is looked at once per lap of the top level. Each slot
+// is a doubly linked list threaded through per-index arrays, so there is no
+// allocation per timer. A bitmap of occupied slots per level, and a lower
+// bound on the deadlines in the overflow list, let advance() jump straight
+// to the next slot with anything in it, however far away that is.
+template<class Index, std::size_t Levels = 4>
+class TimerWheel {
+  private:
+    using T = typename Index::Underlying;
+
+    static constexpr std::size_t slotBits = 6;
+    static constexpr std::size_t slots = std::size_t(1) << slotBits;
+    static constexpr std::uint64_t slotMask = slots - 1;
+    static_assert(Levels >= 1 && Levels * slotBits < 64,
+                  "A TimerWheel needs between 1 and 10 levels.");
+
+  public:
+    // The number of ticks ahead which fit in the wheels without overflowing.
+    static constexpr std::uint64_t span = std::uint64_t(1)
+                                          << (slotBits * Levels);
+
+    explicit TimerWheel(std::uint64_t now = 0) noexcept: now_(now) {
+        heads_.fill(none);
+    }
+
+    std::uint64_t now() const noexcept { return now_; }
+
+    // The number of timers set.
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+
+    bool is_scheduled(Index index) const noexcept {
+        const std::size_t i = to_position(index);
+        return i < nodes_.size() && nodes_[i].bucket != unscheduled;
+    }
+
+    std::optional<std::uint64_t> deadline(Index index) const noexcept {
+        if (!is_scheduled(index)) return std::nullopt;
+        return nodes_[to_position(index)].deadline;
+    }
+
+    // Sets the timer for index, replacing any it already had. A deadline
+    // which has already passed expires on the next tick.
+    void schedule(Index index, std::uint64_t deadline) {
+        const std::size_t i = to_position(index);
+        if (i >= nodes_.size()) nodes_.resize(i + 1);
+        if (nodes_[i].bucket != unscheduled) {
+            unlink(i);
+        } else {
+            ++size_;
+        }
+        nodes_[i].deadline = deadline;
+        place(i, deadline > now_ ? deadline : now_ + 1);
+    }
+
+    // Cancels the timer for index. Returns false if it didn't have one.
+    bool cancel(Index index) noexcept {
+        if (!is_scheduled(index)) return false;
+        const std::size_t i = to_position(index);
+        unlink(i);
+        nodes_[i].bucket = unscheduled;
+        --size_;
+        return true;
+    }
+
+    // Moves the clock forward to now, appending every index whose deadline
+    // is at or before then to expired, in order of deadline. Returns the
+    // number appended. The expired timers are no longer set, so they can be
+    // scheduled again straight away.
+    std::size_t advance(std::uint64_t now, std::vector<Index>& expired) {
+        const std::size_t before = expired.size();
+        while (now_ < now) {
+            if (size_ == 0) {
+                now_ = now;
+                break;
+            }
+            const std::uint64_t next = next_event();
+            if (next > now) {
+                now_ = now;
+                break;
+            }
+            now_ = next;
+            if ((now_ & slotMask) == 0) cascade(1);
+            expire(now_ & slotMask, expired);
+        }
+        return expired.size() - before;
+    }
+
+    // Like advance(now, expired), but calls function(Index) on each expired
+    // index instead. function may schedule new timers.
+    template<class Function>
+    std::size_t advance(std::uint64_t now, Function function) {
+        std::vector<Index> expired;
+        advance(now, expired);
+        for (Index index : expired) std::invoke(function, index);
+        return expired.size();
+    }
+
+  private:
+    static constexpr T none = std::numeric_limits<T>::max();
+    static constexpr std::uint32_t overflow = Levels * slots;
+    static constexpr std::uint32_t unscheduled = overflow + 1;
+
+    struct Node {
+        T next = none;
+        T previous = none;
+        std::uint32_t bucket = unscheduled;
+        std::uint64_t deadline = 0;
+    };
+
+    std::uint64_t now_;
+    std::size_t size_ = 0;
+    std::vector<Node> nodes_;
+    // The first node in each level's slots, then the overflow list.
+    std::array<T, Levels * slots + 1> heads_;
+    std::array<std::uint64_t, Levels> occupied_{};
+    // No timer in the overflow list is due before this.
+    std::uint64_t overflowDue_ = std::numeric_limits<std::uint64_t>::max();
+
+    // The next tick after now_ at which there is anything to do: the next
+    // occupied slot on level 0 in this lap, or else the start of the next
+    // occupied slot on the lowest level that has one later in its lap,
+    // which is where its timers cascade down. Timers on a higher level are
+    // always in a later slot than the current one, so the first level with
+    // any has the earliest. Failing that, it's the start of the top-level
+    // lap in which the earliest overflow timer could be due.
+    std::uint64_t next_event() const noexcept {
+        for (std::size_t level = 0; level < Levels; ++level) {
+            const std::size_t shift = slotBits * level;
+            const std::size_t slot = (now_ >> shift) & slotMask;
+            const std::uint64_t later = slot + 1 < slots
+                    ? occupied_[level] & (~std::uint64_t(0) << (slot + 1))
+                    : 0;
+            if (later != 0) {
+                const std::size_t lapBits = shift + slotBits;
+                return ((now_ >> lapBits) << lapBits)
+                       + (std::uint64_t(std::countr_zero(later)) << shift);
+            }
+        }
+        if (heads_[overflow] == none) {
+            return std::numeric_limits<std::uint64_t>::max();
+        }
+        const std::size_t lapBits = slotBits * Levels;
+        const std::uint64_t nextLap = ((now_ >> lapBits) + 1) << lapBits;
+        const std::uint64_t dueLap = (overflowDue_ >> lapBits) << lapBits;
+        return dueLap > nextLap ? dueLap : nextLap;
+    }
+
+    // Puts node i in the right bucket for when it is due, which must be no
+    // earlier than now_.
+    void place(std::size_t i, std::uint64_t due) noexcept {
+        std::uint32_t bucket = overflow;
+        for (std::size_t level = 0; level < Levels; ++level) {
+            const std::size_t lapBits = slotBits * (level + 1);
+            if ((due >> lapBits) == (now_ >> lapBits)) {
+                const std::size_t slot = (due >> (slotBits * level))
+                                         & slotMask;
+                bucket = static_cast<std::uint32_t>(level * slots + slot);
+                break;
+            }
+        }
+        if (bucket == overflow && due < overflowDue_) overflowDue_ = due;
+        link(i, bucket);
+    }
+
+    void link(std::size_t i, std::uint32_t bucket) noexcept {
+        Node& node = nodes_[i];
+        node.bucket = bucket;
+        node.previous = none;
+        node.next = heads_[bucket];
+        if (node.next != none) {
+            nodes_[node.next].previous = static_cast<T>(i);
+        }
+        heads_[bucket] = static_cast<T>(i);
+        if (bucket != overflow) {
+            occupied_[bucket / slots] |= std::uint64_t(1) << (bucket % slots);
+        }
+    }
+
+    void unlink(std::size_t i) noexcept {
+        Node& node = nodes_[i];
+        if (node.previous != none) {
+            nodes_[node.previous].next = node.next;
+        } else {
+            heads_[node.bucket] = node.next;
+            if (node.next == none && node.bucket != overflow) {
+                occupied_[node.bucket / slots]
+                        &= ~(std::uint64_t(1) << (node.bucket % slots));
+            }
+        }
+        if (node.next != none) nodes_[node.next].previous = node.previous;
+    }
+
+    // Empties a bucket, returning its first node.
+    T take(std::uint32_t bucket) noexcept {
+        const T first = std::exchange(heads_[bucket], none);
+        if (bucket != overflow) {
+            occupied_[bucket / slots] &= ~(std::uint64_t(1)
+                                           << (bucket % slots));
+        }
+        return first;
+    }
+
+    // Called when the clock reaches the start of a slot on level, to move
+    // that slot's timers down to the levels below. Higher levels go first,
+    // since they may have timers for this same slot.
+    void cascade(std::size_t level) noexcept {
+        if (level == Levels) {
+            overflowDue_ = std::numeric_limits<std::uint64_t>::max();
+            for (T i = take(overflow); i != none;) {
+                const T next = nodes_[i].next;
+                place(i, nodes_[i].deadline);
+                i = next;
+            }
+            return;
+        }
+        const std::size_t slot = (now_ >> (slotBits * level)) & slotMask;
+        if (slot == 0) cascade(level + 1);
+        for (T i = take(static_cast<std::uint32_t>(level * slots + slot));
+             i != none;) {
+            const T next = nodes_[i].next;
+            const std::uint64_t deadline = nodes_[i].deadline;
+            place(i, deadline > now_ ? deadline : now_);
+            i = next;
+        }
+    }
+
+    void expire(std::size_t slot, std::vector<Index>& expired) {
+        for (T i = take(static_cast<std::uint32_t>(slot)); i != none;) {
+            Node& node = nodes_[i];
+            expired.push_back(Index(i));
+            node.bucket = unscheduled;
+            --size_;
+            i = node.next;
+        }
+    }
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_TIMER_WHEEL
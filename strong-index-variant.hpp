@@ -0,0 +1,206 @@
+// strong-index-variant.hpp: an index which may be any one of several kinds of
+// index, in the space of just one.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_VARIANT
+#define STRONG_INDEX_VARIANT
+
+#include "strong-index.hpp"
+
+#include <algorithm>    // copy
+#include <array>
+#include <bit>          // bit_width
+#include <cstddef>      // size_t
+#include <functional>   // hash, invoke
+#include <iostream>     // operator<<
+#include <limits>       // numeric_limits
+#include <optional>
+#include <span>
+#include <stdexcept>    // invalid_argument, out_of_range
+#include <tuple>        // tuple_element
+#include <type_traits>  // common_type, enable_if, invoke_result, is_same
+#include <utility>      // forward, index_sequence
+#include <variant>      // bad_variant_access
+#include <vector>
+
+namespace StrongIndex {
+
+// An IndexVariant<UserId, OrderId> holds either a UserId or an OrderId. Unlike
+// a std::variant it is no bigger than the indices themselves: which kind of
+// index it holds is stored in the top bits of the word, so those bits can't be
+// used by the index values. With 2 alternatives that costs one bit, with 3 or
+// 4 it costs two, and so on. A column of IndexVariants is a plain array of
+// integers, which partition() can split into one run per alternative.
+//
+// Storing an index whose value needs the top bits throws std::out_of_range.
+template<class... Indices>
+class IndexVariant {
+  public:
+    static_assert(sizeof...(Indices) > 1,
+                  "An IndexVariant needs at least two alternatives.");
+
+    using Underlying = std::common_type_t<typename Indices::Underlying...>;
+    static_assert(std::is_unsigned_v<Underlying>,
+                  "IndexVariant alternatives must be unsigned.");
+
+    static constexpr std::size_t alternativeCount = sizeof...(Indices);
+    static constexpr unsigned discriminatorBits
+            = std::bit_width(alternativeCount - 1);
+    static constexpr unsigned valueBits
+            = std::numeric_limits<Underlying>::digits - discriminatorBits;
+    static constexpr Underlying maxValue
+            = (Underlying(1) << valueBits) - 1;
+
+    // The position of Index in the list of alternatives.
+    template<class Index>
+    static constexpr std::size_t alternative_of() noexcept {
+        constexpr std::size_t matchCount
+                = (std::size_t(std::is_same_v<Index, Indices>) + ...);
+        static_assert(matchCount == 1,
+                      "Each alternative must appear exactly once.");
+        constexpr std::array<bool, alternativeCount> matches{
+                std::is_same_v<Index, Indices>...};
+        std::size_t position = 0;
+        while (!matches[position]) ++position;
+        return position;
+    }
+
+    // Like std::variant, any of the alternatives converts implicitly.
+    template<class Index, class = std::enable_if_t<
+                     (std::is_same_v<Index, Indices> || ...)>>
+    constexpr IndexVariant(Index index):
+            word_(pack(alternative_of<Index>(),
+                       static_cast<typename Index::Underlying>(index))) {
+    }
+
+    // Rebuilds a variant from a word produced by the conversion below, e.g.
+    // one read back from storage. Throws std::invalid_argument if its
+    // discriminator doesn't name an alternative.
+    constexpr explicit IndexVariant(Underlying packedWord): word_(packedWord) {
+        if (alternative() >= alternativeCount) {
+            throw std::invalid_argument("Packed word does not hold a valid "
+                                        "IndexVariant.");
+        }
+    }
+
+    constexpr explicit operator Underlying() const noexcept {
+        return word_;
+    }
+
+    // Which alternative is held, as a position in the list of alternatives.
+    constexpr std::size_t alternative() const noexcept {
+        return static_cast<std::size_t>(word_ >> valueBits);
+    }
+
+    template<class Index>
+    constexpr bool holds() const noexcept {
+        return alternative() == alternative_of<Index>();
+    }
+
+    // Throws std::bad_variant_access if a different alternative is held.
+    template<class Index>
+    constexpr Index get() const {
+        if (!holds<Index>()) throw std::bad_variant_access();
+        return Index(static_cast<typename Index::Underlying>(value()));
+    }
+
+    template<class Index>
+    constexpr std::optional<Index> try_get() const noexcept {
+        if (!holds<Index>()) return std::nullopt;
+        return Index(static_cast<typename Index::Underlying>(value()));
+    }
+
+    // Calls visitor with whichever index is held. Dispatch is a single
+    // indirect call through a table, not a chain of comparisons. Every
+    // overload of the visitor must return the same type.
+    template<class Visitor>
+    decltype(auto) visit(Visitor&& visitor) const {
+        using Result = std::invoke_result_t<
+                Visitor&&, std::tuple_element_t<0, std::tuple<Indices...>>>;
+        return visit_with<Result>(std::forward<Visitor>(visitor),
+                                  std::index_sequence_for<Indices...>());
+    }
+
+    // Stably reorders values so that each alternative forms one contiguous
+    // run, in the order the alternatives are listed. Alternative k ends up in
+    // [offsets[k], offsets[k+1]) of the returned offsets.
+    static std::array<std::size_t, alternativeCount + 1> partition(
+            std::span<IndexVariant> values) {
+        std::array<std::size_t, alternativeCount + 1> offsets{};
+        for (const IndexVariant& value : values) {
+            ++offsets[value.alternative() + 1];
+        }
+        for (std::size_t k = 0; k < alternativeCount; ++k) {
+            offsets[k + 1] += offsets[k];
+        }
+
+        std::vector<IndexVariant> sorted(values.begin(), values.end());
+        std::array<std::size_t, alternativeCount> next{};
+        std::copy(offsets.begin(), offsets.end() - 1, next.begin());
+        for (const IndexVariant& value : sorted) {
+            values[next[value.alternative()]++] = value;
+        }
+        return offsets;
+    }
+
+    constexpr friend bool operator==(const IndexVariant& a,
+                                     const IndexVariant& b) noexcept {
+        return a.word_ == b.word_;
+    }
+
+    constexpr friend bool operator!=(const IndexVariant& a,
+                                     const IndexVariant& b) noexcept {
+        return !(a == b);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os,
+                                    const IndexVariant& idx) {
+        return os << idx.alternative() << ':' << idx.value();
+    }
+
+  private:
+    Underlying word_;
+
+    constexpr Underlying value() const noexcept {
+        return word_ & maxValue;
+    }
+
+    template<class T>
+    static constexpr Underlying pack(std::size_t alternative, T value) {
+        if (static_cast<Underlying>(value) > maxValue) {
+            throw std::out_of_range("Index is too large for an IndexVariant.");
+        }
+        return static_cast<Underlying>(
+                static_cast<Underlying>(alternative) << valueBits
+                | static_cast<Underlying>(value));
+    }
+
+    template<class Result, class Visitor, std::size_t... I>
+    Result visit_with(Visitor&& visitor, std::index_sequence<I...>) const {
+        using Thunk = Result (*)(Visitor&&, Underlying);
+        static constexpr Thunk table[] = {
+            [](Visitor&& v, Underlying value) -> Result {
+                using Index = std::tuple_element_t<I, std::tuple<Indices...>>;
+                return std::invoke(std::forward<Visitor>(v), Index(
+                        static_cast<typename Index::Underlying>(value)));
+            }...
+        };
+        return table[alternative()](std::forward<Visitor>(visitor), value());
+    }
+};
+
+} // namespace StrongIndex
+
+template<class... Indices>
+struct std::hash<StrongIndex::IndexVariant<Indices...>> {
+    std::size_t operator()(const StrongIndex::IndexVariant<Indices...>& index)
+            const noexcept {
+        using Underlying
+                = typename StrongIndex::IndexVariant<Indices...>::Underlying;
+        return std::hash<Underlying>()(static_cast<Underlying>(index));
+    }
+};
+
+#endif // STRONG_INDEX_VARIANT
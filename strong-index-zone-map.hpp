@@ -0,0 +1,202 @@
+// strong-index-zone-map.hpp: index-keyed columns with per-block statistics,
+// so that scans can skip blocks which can't match.
+//
+// Copyright 2020 Charles Hussong
+// Apache 2.0
+
+#ifndef STRONG_INDEX_ZONE_MAP
+#define STRONG_INDEX_ZONE_MAP
+
+#include "strong-index-containers.hpp"
+
+#include <algorithm>    // min
+#include <cstddef>      // size_t
+#include <functional>   // invoke
+#include <utility>      // move
+#include <vector>
+
+namespace StrongIndex {
+
+// What a ZonedColumn knows about one block of rows without looking at them.
+// min and max only mean something if the block has any non-null values.
+template<class Value>
+struct BlockStats {
+    Value min{};
+    Value max{};
+    std::size_t nullCount = 0;
+    std::size_t valueCount = 0;
+
+    // Whether any non-null value in the block could be in [low, high].
+    bool may_contain(const Value& low, const Value& high) const noexcept {
+        return valueCount > 0 && !(max < low) && !(high < min);
+    }
+};
+
+// A ZonedColumn is an append-only, index-keyed column of possibly-null
+// values, which keeps a zone map: the minimum, maximum and number of nulls
+// in every block of BlockSize rows. They are updated as rows are appended,
+// so they're always current. A range predicate first checks the zone map,
+// and only reads the blocks whose [min, max] overlap the range, which makes
+// most blocks free to skip when the values are correlated with the index,
+// like timestamps in a column appended in time order.
+template<class Index, class Value, std::size_t BlockSize = 1024>
+class ZonedColumn {
+  private:
+    using T = typename Index::Underlying;
+
+  public:
+    static constexpr std::size_t blockSize = BlockSize;
+    static_assert(BlockSize > 0, "Blocks must have at least one row.");
+
+    ZonedColumn() = default;
+
+    std::size_t size() const noexcept { return values_.size(); }
+    bool empty() const noexcept { return values_.empty(); }
+    std::size_t block_count() const noexcept { return blocks_.size(); }
+
+    Index push_back(Value value) {
+        return append(std::move(value), true,
+                      [](BlockStats<Value>& stats, const Value& added) {
+            if (stats.valueCount == 0) {
+                stats.min = added;
+                stats.max = added;
+            } else {
+                if (added < stats.min) stats.min = added;
+                if (stats.max < added) stats.max = added;
+            }
+            ++stats.valueCount;
+        });
+    }
+
+    Index push_null() {
+        return append(Value(), false, [](BlockStats<Value>& stats,
+                                         const Value&) noexcept {
+            ++stats.nullCount;
+        });
+    }
+
+    bool is_null(Index index) const noexcept { return !valid_.test(index); }
+
+    // The value at index, which must not be null.
+    const Value& operator[](Index index) const noexcept {
+        return values_[index];
+    }
+
+    const BlockStats<Value>& block_stats(std::size_t block) const noexcept {
+        return blocks_[block];
+    }
+
+    // The rows in a block.
+    IndexRange<Index> block_rows(std::size_t block) const noexcept {
+        const std::size_t first = block * BlockSize;
+        const std::size_t last = std::min(first + BlockSize, size());
+        return IndexRange<Index>(Index(static_cast<T>(first)),
+                                 Index(static_cast<T>(last)));
+    }
+
+    // The ranges of rows in blocks whose stats satisfy keep(BlockStats), with
+    // neighbouring blocks merged into one range.
+    template<class Predicate>
+    std::vector<IndexRange<Index>> candidates_if(Predicate keep) const {
+        std::vector<IndexRange<Index>> ranges;
+        std::size_t first = 0;
+        bool open = false;
+        for (std::size_t b = 0; b <= blocks_.size(); ++b) {
+            const bool candidate = b < blocks_.size()
+                                   && std::invoke(keep, blocks_[b]);
+            if (candidate && !open) {
+                first = b;
+                open = true;
+            } else if (!candidate && open) {
+                ranges.emplace_back(block_rows(first).first(),
+                                    block_rows(b - 1).last());
+                open = false;
+            }
+        }
+        return ranges;
+    }
+
+    // The ranges of rows which might hold a value in [low, high].
+    std::vector<IndexRange<Index>> candidates(const Value& low,
+                                              const Value& high) const {
+        return candidates_if([&](const BlockStats<Value>& stats) {
+            return stats.may_contain(low, high);
+        });
+    }
+
+    // Calls function(Index, const Value&) on every non-null value in
+    // [low, high], in order, reading only the candidate blocks.
+    template<class Function>
+    void scan_between(const Value& low, const Value& high,
+                      Function function) const {
+        for (std::size_t b = 0; b < blocks_.size(); ++b) {
+            const BlockStats<Value>& stats = blocks_[b];
+            if (!stats.may_contain(low, high)) continue;
+            // A block which lies entirely inside the range with no nulls
+            // needs no per-row tests at all.
+            const bool all = stats.nullCount == 0 && !(stats.min < low)
+                             && !(high < stats.max);
+            for (Index index : block_rows(b)) {
+                const Value& value = values_[index];
+                if (all || (valid_.test(index) && !(value < low)
+                            && !(high < value))) {
+                    std::invoke(function, index, value);
+                }
+            }
+        }
+    }
+
+    // The number of non-null values in [low, high].
+    std::size_t count_between(const Value& low, const Value& high) const {
+        std::size_t count = 0;
+        for (std::size_t b = 0; b < blocks_.size(); ++b) {
+            const BlockStats<Value>& stats = blocks_[b];
+            if (!stats.may_contain(low, high)) continue;
+            if (stats.nullCount == 0 && !(stats.min < low)
+                && !(high < stats.max)) {
+                count += stats.valueCount;
+                continue;
+            }
+            for (Index index : block_rows(b)) {
+                const Value& value = values_[index];
+                count += valid_.test(index) && !(value < low)
+                         && !(high < value);
+            }
+        }
+        return count;
+    }
+
+    const IndexedVector<Index, Value>& values() const noexcept {
+        return values_;
+    }
+    const IndexBitmap<Index>& validity() const noexcept { return valid_; }
+
+  private:
+    IndexedVector<Index, Value> values_;
+    IndexBitmap<Index> valid_;
+    std::vector<BlockStats<Value>> blocks_;
+
+    // Appends a row, then has record(BlockStats&, const Value&) bring its
+    // block's stats up to date. If any step throws, whatever was added is
+    // taken back off, so the stats and bitmap never cover a missing row.
+    template<class Record>
+    Index append(Value value, bool valid, Record record) {
+        const std::size_t rows = values_.size();
+        if (rows % BlockSize == 0) blocks_.emplace_back();
+        try {
+            const Index index = values_.push_back(std::move(value));
+            valid_.push_back(valid);
+            record(blocks_.back(), values_[index]);
+            return index;
+        } catch (...) {
+            values_.resize(rows);
+            valid_.resize(rows);
+            if (rows % BlockSize == 0) blocks_.pop_back();
+            throw;
+        }
+    }
+};
+
+} // namespace StrongIndex
+
+#endif // STRONG_INDEX_ZONE_MAP
@@ -15,7 +15,7 @@ namespace StrongIndex {
 // Every instantiation of all index types must have a tag, typically an empty 
 // struct like StrongIndex<struct UserIdTag>. The second parameter, T, is the 
 // underlying type of the index which will actually be used inside the 
-// container.
+// container. It is available as Index::Underlying for use in generic code.
 
 // Instead of writing the tags by hand, you can use these macros.
 // If you use them in a header file, please #undef them after using.
@@ -40,6 +40,13 @@ class Basic {
             = std::is_nothrow_copy_constructible_v<T>;
 
   public:
+    using Underlying = T;
+
+    // The same kind of index with the same tag, but a different underlying
+    // type, e.g. a 32-bit version of a 64-bit index for storing on disk.
+    template<typename U>
+    using Rebind = Basic<Tag, U>;
+
     constexpr explicit Basic(T underlyingIndex) noexcept(noThrowIndex):
             index_(underlyingIndex) {
     }
@@ -84,6 +91,11 @@ class Incrementable {
             = std::is_nothrow_copy_constructible_v<T>;
 
   public:
+    using Underlying = T;
+
+    template<typename U>
+    using Rebind = Incrementable<Tag, U>;
+
     constexpr explicit Incrementable(T underlyingIndex) noexcept(noThrowIndex):
             index_(underlyingIndex) {
     }
@@ -179,6 +191,11 @@ class FullArithmetic {
             = std::is_nothrow_copy_constructible_v<T>;
 
   public:
+    using Underlying = T;
+
+    template<typename U>
+    using Rebind = FullArithmetic<Tag, U>;
+
     constexpr explicit FullArithmetic(T underlyingIndex) noexcept(noThrowIndex):
             index_(underlyingIndex) {
     }
@@ -6,8 +6,44 @@
 #define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
 #include "doctest.h"
 #include "strong-index.hpp"
+#include "strong-index-arrow.hpp"
+#include "strong-index-btree.hpp"
+#include "strong-index-containers.hpp"
+#include "strong-index-convert.hpp"
+#include "strong-index-cow.hpp"
+#include "strong-index-dictionary.hpp"
+#include "strong-index-dirty.hpp"
+#include "strong-index-enum.hpp"
+#include "strong-index-flat-map.hpp"
+#include "strong-index-huge-pages.hpp"
+#include "strong-index-interleave.hpp"
+#include "strong-index-lazy.hpp"
+#include "strong-index-numa.hpp"
+#include "strong-index-nullable.hpp"
+#include "strong-index-packed-index.hpp"
+#include "strong-index-packed-vector.hpp"
+#include "strong-index-pipeline.hpp"
+#include "strong-index-rcu.hpp"
+#include "strong-index-rolling.hpp"
+#include "strong-index-snowflake.hpp"
+#include "strong-index-stable-vector.hpp"
+#include "strong-index-tasks.hpp"
+#include "strong-index-timer-wheel.hpp"
+#include "strong-index-variant.hpp"
+#include "strong-index-zone-map.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <sstream>
+#include <thread>
+#include <unordered_set>
 
 using Underlying = std::size_t;
 
@@ -120,3 +156,1382 @@ TEST_CASE("Full arithmetic operations work") {
     test_incrementable(index, value);
     test_full_arithmetic(index, value);
 }
+
+TEST_CASE("IndexedVector is accessed by index") {
+    StrongIndex::IndexedVector<Basic, int> vector(3, 7);
+    REQUIRE(vector.size() == 3);
+    vector[Basic(1)] = 12;
+    CHECK(vector[Basic(0)] == 7);
+    CHECK(vector[Basic(1)] == 12);
+    CHECK_THROWS_AS(vector.at(Basic(3)), std::out_of_range);
+
+    Basic appended = vector.push_back(40);
+    CHECK(appended == 3);
+    CHECK(vector.at(appended) == 40);
+}
+
+TEST_CASE("HugePageAllocator backs large and small vectors") {
+    using Allocator = StrongIndex::HugePageAllocator<std::uint32_t>;
+    static constexpr std::size_t count = 3 * Allocator::hugePageSize / 4 + 5;
+    StrongIndex::IndexedVector<Basic, std::uint32_t, Allocator> large(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        large[Basic(i)] = static_cast<std::uint32_t>(i * 3);
+    }
+    CHECK(large[Basic(count - 1)] == (count - 1) * 3);
+#if defined(__linux__)
+    auto address = reinterpret_cast<std::uintptr_t>(large.data());
+    CHECK(address % Allocator::hugePageSize == 0);
+#endif
+
+    StrongIndex::IndexedVector<Basic, std::uint32_t, Allocator> small(10, 5);
+    CHECK(small[Basic(9)] == 5);
+}
+
+TEST_CASE("IndexRange iterates over indices") {
+    StrongIndex::IndexRange<Basic> range(Basic(3), Basic(6));
+    CHECK(range.size() == 3);
+    CHECK(range.contains(Basic(5)));
+    CHECK(!range.contains(Basic(6)));
+    Underlying expected = 3;
+    for (Basic index : range) CHECK(index == expected++);
+    CHECK(expected == 6);
+}
+
+TEST_CASE("NumaPartitionedArray splits indices between nodes") {
+    CHECK(StrongIndex::NumaTopology::parse_cpu_list("0-2,5")
+          == std::vector<int>{0, 1, 2, 5});
+    CHECK(StrongIndex::NumaTopology::detect().size() >= 1);
+
+    // Pretend the machine has two nodes so the partitioning is exercised
+    // even on a single-node test machine.
+    StrongIndex::NumaTopology topology({{0, {0}}, {1, {0}}});
+    static constexpr std::size_t size = 100000;
+    StrongIndex::NumaPartitionedArray<Basic, std::uint64_t> array(size,
+                                                                  topology);
+    REQUIRE(array.partition_count() == 2);
+    auto split = static_cast<Underlying>(array.partition(0).last());
+    CHECK(array.partition(0).first() == 0);
+    CHECK(array.partition(1).first() == split);
+    CHECK(array.partition(1).last() == size);
+    CHECK(split * sizeof(std::uint64_t) % 4096 == 0);
+    CHECK(array.partition_of(Basic(split - 1)) == 0);
+    CHECK(array.partition_of(Basic(split)) == 1);
+    CHECK(array[Basic(size - 1)] == 0);
+
+    array.parallel_for([&](StrongIndex::IndexRange<Basic> range) {
+        for (Basic index : range) {
+            array[index] = static_cast<Underlying>(index);
+        }
+    }, 3);
+    std::atomic<std::uint64_t> total{0};
+    array.parallel_for([&](StrongIndex::IndexRange<Basic> range) {
+        std::uint64_t subtotal = 0;
+        for (Basic index : range) subtotal += array[index];
+        total += subtotal;
+    });
+    CHECK(total == size * (size - 1) / 2);
+
+    auto moved = std::move(array);
+    CHECK(moved.partition_count() == 2);
+    CHECK(array.partition_count() == 0);
+    bool called = false;
+    array.parallel_for([&](StrongIndex::IndexRange<Basic>) { called = true; });
+    CHECK(!called);
+}
+
+TEST_CASE("PackedIndexVector stores indices in a few bits each") {
+    StrongIndex::PackedIndexVector<Basic, 21> fixed;
+    static constexpr std::size_t count = 1000;
+    for (std::size_t i = 0; i < count; ++i) {
+        fixed.push_back(Basic((i * 7919) % fixed.max_value()));
+    }
+    REQUIRE(fixed.size() == count);
+    CHECK(fixed.bytes() == (count * 21 + 7) / 8);
+    CHECK(fixed[999] == (999 * 7919) % fixed.max_value());
+    CHECK_THROWS_AS(fixed.push_back(Basic(Underlying(1) << 21)),
+                    std::out_of_range);
+
+    fixed.set(500, Basic(fixed.max_value()));
+    CHECK(fixed[499] == (499 * 7919) % fixed.max_value());
+    CHECK(fixed.at(500) == fixed.max_value());
+    CHECK(fixed[501] == (501 * 7919) % fixed.max_value());
+
+    std::vector<Basic> unpacked(count - 3, Basic(0));
+    fixed.unpack(3, unpacked);
+    for (std::size_t i = 0; i < unpacked.size(); ++i) {
+        CHECK(unpacked[i] == fixed[i + 3]);
+    }
+
+    using Runtime = StrongIndex::PackedIndexVector<Basic>;
+    CHECK(Runtime::required_bits(1500000) == 21);
+    Runtime runtime(Runtime::required_bits(5));
+    CHECK(runtime.bits() == 3);
+    for (Underlying i = 0; i < 20; ++i) runtime.push_back(Basic(i % 6));
+    CHECK(runtime[19] == 1);
+    runtime.resize(2);
+    runtime.resize(4);
+    CHECK(runtime[3] == 0);
+    CHECK_THROWS_AS(Runtime(58), std::invalid_argument);
+}
+
+TEST_CASE("PackedIndex packs typed fields into one word") {
+    using StrongIndex::Field;
+    using Shard = StrongIndex::Basic<struct ShardTag>;
+    using Table = StrongIndex::Basic<struct TableTag>;
+    using Row = StrongIndex::Basic<struct RowTag>;
+    using RowKey = StrongIndex::PackedIndex<struct RowKeyTag,
+                                            Field<ShardTag, 10>,
+                                            Field<TableTag, 6>,
+                                            Field<RowTag, 48>>;
+    static_assert(sizeof(RowKey) == sizeof(std::uint64_t));
+    static_assert(std::is_same_v<RowKey::IndexOf<RowTag>, Row>);
+
+    static constexpr RowKey key(Shard(1000), Table(63), Row(123456789));
+    static_assert(key.get<ShardTag>() == Shard(1000));
+    static_assert(key.get<1>() == Table(63));
+    CHECK(static_cast<Underlying>(key.get<RowTag>()) == 123456789);
+    CHECK(static_cast<std::uint64_t>(key)
+          == (std::uint64_t(1000) << 54 | std::uint64_t(63) << 48
+              | 123456789));
+
+    RowKey moved = key.with<ShardTag>(Shard(3));
+    CHECK(moved.get<ShardTag>() == Shard(3));
+    CHECK(moved.get<RowTag>() == key.get<RowTag>());
+    CHECK(moved < key);
+    CHECK(RowKey(Shard(3), Table(0), Row(5))
+          < RowKey(Shard(3), Table(1), Row(0)));
+    CHECK_THROWS_AS(RowKey(Shard(1024), Table(0), Row(0)), std::out_of_range);
+    CHECK_THROWS_AS(key.with<TableTag>(Table(64)), std::out_of_range);
+
+    std::unordered_set<RowKey> keys{key, moved, key};
+    CHECK(keys.size() == 2);
+
+    using Small = StrongIndex::PackedIndex<struct SmallTag,
+                                           Field<ShardTag, 16>,
+                                           Field<RowTag, 16>>;
+    static_assert(sizeof(Small) == sizeof(std::uint32_t));
+    CHECK(Small(Shard(0xffff), Row(1)).get<ShardTag>() == Shard(0xffff));
+}
+
+// A clock which only moves when the test tells it to.
+struct ManualClock {
+    using duration = std::chrono::milliseconds;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<ManualClock>;
+    static constexpr bool is_steady = false;
+
+    static inline time_point current{};
+    static time_point now() noexcept { return current; }
+};
+
+TEST_CASE("SnowflakeGenerator produces time-ordered IDs") {
+    using namespace StrongIndex;
+    using EventId = SnowflakeId<struct EventTag, 41, 10, 2>;
+    ManualClock::current = ManualClock::time_point(
+            std::chrono::milliseconds(1000));
+    const ManualClock::time_point manualEpoch;
+    SnowflakeGenerator<EventId, ManualClock> generator(SnowflakeWorker(5),
+                                                       manualEpoch);
+    CHECK_THROWS_AS((SnowflakeGenerator<EventId, ManualClock>(
+            SnowflakeWorker(1024), manualEpoch)), std::out_of_range);
+
+    EventId first = generator.next();
+    CHECK(first.get<SnowflakeTimestampTag>() == SnowflakeTimestamp(1000));
+    CHECK(first.get<SnowflakeWorkerTag>() == SnowflakeWorker(5));
+    CHECK(first.get<SnowflakeSequenceTag>() == SnowflakeSequence(0));
+    CHECK(generator.time_of(first) == ManualClock::current);
+
+    // Four IDs fit in a millisecond, after which the next one is borrowed.
+    EventId previous = first;
+    for (int i = 0; i < 4; ++i) {
+        EventId id = generator.next();
+        CHECK(previous < id);
+        previous = id;
+    }
+    CHECK(previous.get<SnowflakeTimestampTag>() == SnowflakeTimestamp(1001));
+    CHECK(previous.get<SnowflakeSequenceTag>() == SnowflakeSequence(0));
+
+    // Going back in time doesn't make the IDs go backwards.
+    ManualClock::current -= std::chrono::milliseconds(500);
+    CHECK(previous < generator.next());
+    ManualClock::current += std::chrono::milliseconds(1000);
+    EventId later = generator.next();
+    CHECK(later.get<SnowflakeTimestampTag>() == SnowflakeTimestamp(1500));
+
+    // Timestamps count from the epoch given, not the clock's.
+    using BigId = SnowflakeId<struct BigTag>;
+    const auto epoch = std::chrono::system_clock::now() - std::chrono::hours(1);
+    SnowflakeGenerator<BigId> shared(SnowflakeWorker(1), epoch);
+    const BigId recent = shared.next();
+    const auto sinceEpoch = static_cast<std::uint64_t>(
+            recent.get<SnowflakeTimestampTag>());
+    CHECK(sinceEpoch >= 3600000);
+    CHECK(sinceEpoch < 3600000 + 60000);
+    CHECK(shared.time_of(recent) - epoch
+          == std::chrono::milliseconds(sinceEpoch));
+    std::vector<std::vector<BigId>> perThread(4);
+    std::vector<std::thread> threads;
+    for (auto& ids : perThread) {
+        threads.emplace_back([&shared, &ids]() {
+            for (int i = 0; i < 1000; ++i) ids.push_back(shared.next());
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    std::vector<BigId> all;
+    for (auto& ids : perThread) {
+        CHECK(std::is_sorted(ids.begin(), ids.end()));
+        all.insert(all.end(), ids.begin(), ids.end());
+    }
+    std::sort(all.begin(), all.end());
+    CHECK(std::adjacent_find(all.begin(), all.end()) == all.end());
+}
+
+TEST_CASE("IndexVariant holds one of several indices in one word") {
+    using UserId = StrongIndex::Basic<struct UserIdTag>;
+    using OrderId = StrongIndex::Basic<struct OrderIdTag>;
+    using StudentId = StrongIndex::Basic<struct StudentIdTag, std::uint32_t>;
+    using Reference = StrongIndex::IndexVariant<UserId, OrderId, StudentId>;
+    static_assert(sizeof(Reference) == sizeof(std::size_t));
+    static_assert(Reference::discriminatorBits == 2);
+
+    Reference user = UserId(17);
+    Reference order = OrderId(17);
+    Reference student = StudentId(4);
+    CHECK(user != order);
+    CHECK(user.holds<UserId>());
+    CHECK(order.alternative() == 1);
+    CHECK(order.get<OrderId>() == OrderId(17));
+    CHECK_THROWS_AS(order.get<UserId>(), std::bad_variant_access);
+    CHECK(!student.try_get<UserId>());
+    CHECK(*student.try_get<StudentId>() == StudentId(4));
+    CHECK_THROWS_AS(Reference(UserId(~std::size_t(0))), std::out_of_range);
+    CHECK(Reference(static_cast<std::size_t>(student)) == student);
+    CHECK_THROWS_AS(Reference(~std::size_t(0)), std::invalid_argument);
+
+    struct Describe {
+        std::string operator()(UserId id) const {
+            return "user " + std::to_string(static_cast<std::size_t>(id));
+        }
+        std::string operator()(OrderId) const { return "order"; }
+        std::string operator()(StudentId) const { return "student"; }
+    };
+    CHECK(user.visit(Describe()) == "user 17");
+    CHECK(student.visit(Describe()) == "student");
+
+    std::vector<Reference> column{order, user, student, UserId(3), order};
+    auto offsets = Reference::partition(column);
+    CHECK(offsets == std::array<std::size_t, 4>{0, 2, 4, 5});
+    CHECK(column[0] == user);
+    CHECK(column[1] == Reference(UserId(3)));
+    CHECK(column[2] == order);
+    CHECK(column[4] == student);
+}
+
+TEST_CASE("Indices can be narrowed and widened in bulk") {
+    using UserId64 = StrongIndex::Incrementable<struct UserTag, std::uint64_t>;
+    using UserId32 = UserId64::Rebind<std::uint32_t>;
+    static_assert(StrongIndex::isRebindOf<UserId32, UserId64>);
+    static_assert(!StrongIndex::isRebindOf<UserId32, Incrementable>);
+
+    std::vector<UserId64> wide;
+    for (std::uint64_t i = 0; i < 1000; ++i) wide.push_back(UserId64(i * 5));
+    std::vector<UserId32> narrow(wide.size(), UserId32(0));
+    CHECK(StrongIndex::narrow<UserId32>(std::span(wide), std::span(narrow))
+          == wide.size());
+    CHECK(static_cast<std::uint32_t>(narrow[999]) == 4995);
+
+    std::vector<UserId64> roundTrip
+            = StrongIndex::widen<UserId64>(std::span(narrow));
+    CHECK(roundTrip == wide);
+
+    wide[700] = UserId64(std::uint64_t(1) << 32);
+    wide[900] = UserId64(std::uint64_t(1) << 40);
+    std::vector<UserId32> partial(wide.size(), UserId32(7));
+    CHECK(StrongIndex::narrow<UserId32>(std::span(wide), std::span(partial))
+          == 700);
+    CHECK(static_cast<std::uint32_t>(partial[699]) == 3495);
+    CHECK_THROWS_AS(StrongIndex::narrow<UserId32>(
+            std::span<const UserId64>(wide)), std::out_of_range);
+    CHECK_THROWS_AS(StrongIndex::narrow<UserId32>(std::span(wide),
+            std::span(partial).first(10)), std::invalid_argument);
+}
+
+namespace {
+
+using Hour = StrongIndex::Incrementable<struct HourTag, unsigned>;
+using HourlyTable = StrongIndex::IndexedArray<Hour, int, 24>;
+
+constexpr HourlyTable make_hourly_table() {
+    HourlyTable table;
+    for (Hour hour : HourlyTable::indices()) {
+        table[hour] = static_cast<int>(static_cast<unsigned>(hour)) * 2;
+    }
+    return table;
+}
+
+} // namespace
+
+TEST_CASE("IndexedArray can be used at compile time") {
+    static constexpr HourlyTable table = make_hourly_table();
+    static_assert(HourlyTable::size() == 24);
+    static_assert(table[HourlyTable::index<23>()] == 46);
+    static_assert(table[HourlyTable::make_index(5)] == 10);
+    // These don't compile:
+    // table[HourlyTable::index<24>()];
+    // constexpr Hour bad = HourlyTable::make_index(24);
+
+    CHECK_THROWS_AS(HourlyTable::make_index(24), std::out_of_range);
+    CHECK_THROWS_AS(table.at(Hour(30)), std::out_of_range);
+
+    using Priority = StrongIndex::Basic<struct PriorityTag, int>;
+    StrongIndex::IndexedArray<Priority, int, 8> weights(
+            {1, 2, 3, 4, 5, 6, 7, 8});
+    CHECK(weights[Priority(7)] == 8);
+    CHECK_THROWS_AS(weights.at(Priority(-1)), std::out_of_range);
+    weights.fill(0);
+    CHECK(weights.at(Priority(3)) == 0);
+}
+
+namespace {
+
+enum class State { Idle, Running, Done, Count };
+enum class Level : std::uint8_t { Low, High, Last };
+
+using StateHandler = State (*)(int&);
+
+constexpr StrongIndex::EnumArray<State, StateHandler> stateMachine({
+    [](int& work) { return work > 0 ? State::Running : State::Idle; },
+    [](int& work) { return --work > 0 ? State::Running : State::Done; },
+    [](int&) { return State::Done; },
+});
+
+} // namespace
+
+TEST_CASE("EnumIndex indexes dense per-enum tables") {
+    using StateIndex = StrongIndex::EnumIndex<State>;
+    static_assert(StateIndex::count == 3);
+    static_assert(sizeof(StateIndex) == sizeof(State));
+
+    std::vector<State> states;
+    for (StateIndex state : StateIndex::all()) states.push_back(state.value());
+    CHECK(states == std::vector<State>{State::Idle, State::Running,
+                                       State::Done});
+
+    int work = 2;
+    State state = State::Idle;
+    std::vector<State> visited;
+    while (state != State::Done) {
+        state = stateMachine[state](work);
+        visited.push_back(state);
+    }
+    CHECK(visited == std::vector<State>{State::Running, State::Running,
+                                        State::Done});
+
+    StrongIndex::EnumArray<Level, int, Level::Last> counts;
+    ++counts[Level::High];
+    CHECK(counts[Level::High] == 1);
+    CHECK(counts.at(Level::Low) == 0);
+    CHECK(counts.size() == 2);
+    std::stringstream ss;
+    ss << StrongIndex::EnumIndex<Level, Level::Last>(Level::High);
+    CHECK(ss.str() == "1");
+}
+
+TEST_CASE("FlatMap behaves like an ordered map") {
+    StrongIndex::FlatMap<Basic, int> map;
+    std::map<Underlying, int> reference;
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<Underlying> keys(0, 2000);
+
+    for (int round = 0; round < 5; ++round) {
+        std::vector<std::pair<Basic, int>> batch;
+        for (int i = 0; i < 300; ++i) {
+            Underlying key = keys(rng);
+            batch.emplace_back(Basic(key), round * 1000 + i);
+            reference[key] = round * 1000 + i;
+        }
+        map.insert_batch(batch);
+    }
+    CHECK(map.insert_or_assign(Basic(5000), -1));
+    CHECK(!map.insert_or_assign(Basic(5000), -2));
+    CHECK(*map.find(Basic(5000)) == -2);
+    CHECK(map.erase(Basic(5000)));
+    CHECK(!map.erase(Basic(5000)));
+
+    REQUIRE(map.size() == reference.size());
+    CHECK(std::is_sorted(map.keys().begin(), map.keys().end()));
+    for (Underlying key = 0; key <= 2001; ++key) {
+        auto found = reference.find(key);
+        const int* value = map.find(Basic(key));
+        REQUIRE((value != nullptr) == (found != reference.end()));
+        if (value != nullptr) CHECK(*value == found->second);
+        CHECK(map.lower_bound(Basic(key))
+              == static_cast<std::size_t>(std::distance(
+                      reference.begin(), reference.lower_bound(key))));
+    }
+
+    int sum = 0;
+    map.for_each_in_range(Basic(100), Basic(200), [&](Basic key, int value) {
+        CHECK(reference.at(static_cast<Underlying>(key)) == value);
+        sum += value;
+    });
+    int expected = 0;
+    for (auto it = reference.lower_bound(100); it != reference.lower_bound(200);
+         ++it) {
+        expected += it->second;
+    }
+    CHECK(sum == expected);
+}
+
+TEST_CASE("BPlusTree behaves like an ordered map") {
+    // Small nodes so that there are plenty of splits.
+    using Tree = StrongIndex::BPlusTree<Basic, int, 64>;
+    Tree tree;
+    std::map<Underlying, int> reference;
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<Underlying> keys(0, 5000);
+    for (int i = 0; i < 4000; ++i) {
+        Underlying key = keys(rng);
+        bool isNew = reference.count(key) == 0;
+        reference[key] = i;
+        CHECK(tree.insert_or_assign(Basic(key), i) == isNew);
+    }
+    for (int i = 0; i < 1000; ++i) {
+        Underlying key = keys(rng);
+        CHECK(tree.erase(Basic(key)) == (reference.erase(key) > 0));
+    }
+    REQUIRE(tree.size() == reference.size());
+
+    auto expected = reference.begin();
+    for (auto [key, value] : tree) {
+        REQUIRE(expected != reference.end());
+        CHECK(key == expected->first);
+        CHECK(value == expected->second);
+        ++expected;
+    }
+    CHECK(expected == reference.end());
+
+    for (Underlying key = 0; key < 5001; key += 7) {
+        const int* value = tree.find(Basic(key));
+        auto found = reference.find(key);
+        REQUIRE((value != nullptr) == (found != reference.end()));
+        if (value != nullptr) CHECK(*value == found->second);
+    }
+
+    std::size_t inRange = 0;
+    for (auto [key, value] : tree.range(Basic(1000), Basic(2000))) {
+        CHECK(static_cast<Underlying>(key) >= 1000);
+        CHECK(static_cast<Underlying>(key) < 2000);
+        value = -value;
+        ++inRange;
+    }
+    CHECK(inRange == static_cast<std::size_t>(std::distance(
+            reference.lower_bound(1000), reference.lower_bound(2000))));
+    CHECK(tree.lower_bound(Basic(1000)).value() <= 0);
+
+    std::vector<std::pair<Basic, int>> sorted;
+    for (Underlying key = 0; key < 10000; key += 2) {
+        sorted.emplace_back(Basic(key), static_cast<int>(key));
+    }
+    tree.bulk_load(sorted);
+    CHECK(tree.size() == 5000);
+    CHECK(*tree.find(Basic(5000)) == 5000);
+    CHECK(tree.find(Basic(5001)) == nullptr);
+    CHECK(tree.lower_bound(Basic(5001)).key() == Basic(5002));
+    CHECK(tree.insert_or_assign(Basic(5001), 1));
+    CHECK(tree.range(Basic(5000), Basic(5003)).begin().key() == Basic(5000));
+    std::size_t count = 0;
+    for (auto entry : tree) {
+        (void)entry;
+        ++count;
+    }
+    CHECK(count == 5001);
+    std::swap(sorted[0], sorted[1]);
+    CHECK_THROWS_AS(tree.bulk_load(sorted), std::invalid_argument);
+}
+
+TEST_CASE("IndexBitmap tracks a set of indices") {
+    StrongIndex::IndexBitmap<Basic> bitmap(130);
+    bitmap.set(Basic(3));
+    bitmap.set(Basic(64));
+    bitmap.set(Basic(129));
+    bitmap.assign(Basic(3), false);
+    CHECK(!bitmap.test(Basic(3)));
+    CHECK(bitmap.count() == 2);
+    std::vector<Basic> set;
+    bitmap.for_each_set([&](Basic index) { set.push_back(index); });
+    CHECK(set == std::vector<Basic>{Basic(64), Basic(129)});
+
+    StrongIndex::IndexBitmap<Basic> full(70, true);
+    CHECK(full.count() == 70);
+    full.resize(100, true);
+    full.resize(66);
+    CHECK(full.count() == 66);
+    full.push_back(false);
+    CHECK(full.count() == 66);
+}
+
+TEST_CASE("StableVector keeps indices stable until compacted") {
+    StrongIndex::StableVector<Basic, std::string> users;
+    for (int i = 0; i < 200; ++i) users.push_back("user" + std::to_string(i));
+    for (Underlying i = 0; i < 200; i += 3) CHECK(users.erase(Basic(i)));
+    CHECK(!users.erase(Basic(0)));
+    CHECK(!users.contains(Basic(3)));
+    CHECK(users.contains(Basic(4)));
+    CHECK(users[Basic(4)] == "user4");
+    CHECK(users.size() == 133);
+    CHECK(users.tombstone_count() == 67);
+
+    std::size_t visited = 0;
+    users.for_each([&](Basic index, const std::string& name) {
+        CHECK(static_cast<Underlying>(index) % 3 != 0);
+        CHECK(name == "user" + std::to_string(static_cast<Underlying>(index)));
+        ++visited;
+    });
+    CHECK(visited == 133);
+
+    std::vector<Basic> friends{Basic(4), Basic(3), Basic(199), Basic(1)};
+    auto remap = users.compact();
+    CHECK(users.slot_count() == 133);
+    CHECK(users.tombstone_count() == 0);
+    CHECK(remap(Basic(1)) == Basic(0));
+    CHECK(!remap(Basic(0)));
+    CHECK(remap.apply(friends, Basic(~Underlying(0))) == 1);
+    CHECK(users[friends[0]] == "user4");
+    CHECK(friends[1] == Basic(~Underlying(0)));
+    CHECK(users[friends[2]] == "user199");
+    CHECK(users[friends[3]] == "user1");
+    CHECK(users.push_back("new") == Basic(133));
+
+    // Compacting again remaps the same column, orphans included.
+    CHECK(users.erase(friends[3]));
+    auto again = users.compact();
+    CHECK(!again(Basic(~Underlying(0))));
+    CHECK(again.apply(friends, Basic(~Underlying(0))) == 2);
+    CHECK(users[friends[0]] == "user4");
+    CHECK(friends[1] == Basic(~Underlying(0)));
+    CHECK(users[friends[2]] == "user199");
+    CHECK(friends[3] == Basic(~Underlying(0)));
+}
+
+TEST_CASE("CowColumn snapshots are cheap and stay consistent") {
+    using Column = StrongIndex::CowColumn<Basic, std::uint64_t, 64>;
+    static_assert(Column::pageSize == 8);
+    Column scores(100, 1);
+    auto before = scores.snapshot();
+    CHECK(scores.pages_shared_with(before) == 13);
+
+    scores.set(Basic(3), 30);
+    scores.set(Basic(4), 40);
+    scores.mutable_at(Basic(99)) += 5;
+    CHECK(scores.pages_shared_with(before) == 11);
+    CHECK(scores[Basic(3)] == 30);
+    CHECK(before[Basic(3)] == 1);
+    CHECK(before[Basic(99)] == 1);
+    CHECK(scores[Basic(99)] == 6);
+
+    // A reader can keep using its snapshot while the writer carries on.
+    std::atomic<bool> done{false};
+    std::thread reader([&done, view = scores.snapshot()]() {
+        while (!done) {
+            std::uint64_t total = 0;
+            for (Underlying i = 0; i < view.size(); ++i) {
+                total += view[Basic(i)];
+            }
+            CHECK(total == 100 + 29 + 39 + 5);
+        }
+    });
+    for (int round = 0; round < 1000; ++round) {
+        scores.set(Basic(round % 100), round);
+    }
+    done = true;
+    reader.join();
+
+    Basic appended = scores.push_back(7);
+    CHECK(appended == 100);
+    CHECK(before.size() == 100);
+    CHECK(scores.size() == 101);
+}
+
+TEST_CASE("Published tables can be swapped under readers") {
+    using Table = StrongIndex::IndexedVector<Basic, std::uint64_t>;
+    StrongIndex::Published<Table, 4> table(std::make_unique<Table>(64));
+    CHECK(table.current().size() == 64);
+
+    // Every version has all its entries equal, so a reader that saw a mix of
+    // two versions would notice.
+    std::atomic<bool> done{false};
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r) {
+        readers.emplace_back([&table, &done, reader = table.reader()]() {
+            std::uint64_t last = 0;
+            while (!done) {
+                auto version = reader.read();
+                const std::uint64_t first = (*version)[Basic(0)];
+                for (std::uint64_t value : *version) CHECK(value == first);
+                CHECK(first >= last);
+                last = first;
+            }
+        });
+    }
+    for (std::uint64_t round = 1; round <= 500; ++round) {
+        table.publish(std::make_unique<Table>(64, round));
+    }
+    done = true;
+    for (auto& reader : readers) reader.join();
+
+    table.reclaim();
+    CHECK(table.retired_count() == 0);
+    CHECK(table.current()[Basic(63)] == 500);
+
+    // A reader holding on to a version keeps it alive.
+    auto reader = table.reader();
+    {
+        auto held = reader.read();
+        table.update([](Table& next) { next[Basic(0)] = 0; });
+        CHECK(table.retired_count() == 1);
+        CHECK((*held)[Basic(0)] == 500);
+        CHECK(table.current()[Basic(0)] == 0);
+    }
+    CHECK(table.reclaim() == 1);
+
+    auto second = table.reader();
+    auto third = table.reader();
+    auto fourth = table.reader();
+    CHECK_THROWS_AS(table.reader(), std::runtime_error);
+}
+
+TEST_CASE("TrackedVector records which indices changed") {
+    StrongIndex::TrackedVector<Basic, int> scores(1000, 0);
+    CHECK(scores.dirty().empty());
+
+    scores.set(Basic(7), 70);
+    scores.mutable_at(Basic(500)) += 5;
+    scores.set(Basic(7), 71);
+    CHECK(scores.push_back(3) == Basic(1000));
+    CHECK(scores.dirty().count() == 3);
+    CHECK(scores.dirty().contains(Basic(500)));
+    CHECK(!scores.dirty().contains(Basic(8)));
+
+    std::map<Underlying, int> changed;
+    scores.consume_changes([&](Basic index, int score) {
+        changed[static_cast<Underlying>(index)] = score;
+    });
+    CHECK(changed == std::map<Underlying, int>{{7, 71}, {500, 5}, {1000, 3}});
+    CHECK(scores.dirty().empty());
+    scores.consume_changes([](Basic, int) { FAIL("nothing is dirty"); });
+
+    // Once most of it is dirty, the bitmap is scanned instead of the list.
+    for (Underlying i = 0; i < 1001; i += 2) scores.set(Basic(i), 1);
+    std::size_t visited = 0;
+    scores.dirty().for_each([&](Basic index) {
+        CHECK(static_cast<Underlying>(index) % 2 == 0);
+        ++visited;
+    });
+    CHECK(visited == 501);
+    scores.consume_changes([](Basic, int) {});
+    CHECK(scores.dirty().bitmap().count() == 0);
+
+    scores.mark_all_dirty();
+    CHECK(scores.dirty().count() == 1001);
+    StrongIndex::DirtySet<Basic> set(10);
+    set.mark(Basic(9));
+    set.mark(Basic(2));
+    set.resize(5);
+    CHECK(set.count() == 1);
+}
+
+TEST_CASE("LazyColumn computes each value once, on demand") {
+    std::vector<std::atomic<int>> calls(256);
+    StrongIndex::LazyColumn<Basic, std::string> names(256, [&](Basic index) {
+        ++calls[static_cast<Underlying>(index)];
+        return "user" + std::to_string(static_cast<Underlying>(index));
+    });
+    CHECK(names.computed_count() == 0);
+    CHECK(names.peek(Basic(3)) == nullptr);
+    CHECK(names[Basic(3)] == "user3");
+    CHECK(*names.peek(Basic(3)) == "user3");
+    CHECK(names.is_computed(Basic(3)));
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&names]() {
+            for (Underlying i = 0; i < 256; i += 2) {
+                CHECK(names.get(Basic(i)) == "user" + std::to_string(i));
+            }
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    CHECK(names.computed_count() == 129);
+    for (Underlying i = 0; i < 256; ++i) {
+        CHECK(calls[i] == (i % 2 == 0 || i == 3 ? 1 : 0));
+    }
+
+    names.invalidate(Basic(4));
+    CHECK(!names.is_computed(Basic(4)));
+    CHECK(names[Basic(4)] == "user4");
+    CHECK(calls[4] == 2);
+
+    // A failed computation is retried next time.
+    bool fail = true;
+    StrongIndex::LazyColumn<Basic, int> flaky(10, [&](Basic index) {
+        if (std::exchange(fail, false)) throw std::runtime_error("flaky");
+        return static_cast<int>(static_cast<Underlying>(index));
+    });
+    CHECK_THROWS_AS(flaky.get(Basic(5)), std::runtime_error);
+    CHECK(flaky.get(Basic(5)) == 5);
+}
+
+TEST_CASE("BoundedQueue passes values between threads") {
+    StrongIndex::BoundedQueue<std::uint64_t> queue(5);
+    CHECK(queue.capacity() == 8);
+    for (std::uint64_t i = 0; i < 8; ++i) CHECK(queue.try_push(i));
+    std::uint64_t extra = 8;
+    CHECK(!queue.try_push(extra));
+    CHECK(queue.try_pop() == 0u);
+
+    std::atomic<std::uint64_t> total{0};
+    std::vector<std::thread> consumers;
+    for (int c = 0; c < 3; ++c) {
+        consumers.emplace_back([&]() {
+            while (auto value = queue.pop()) total += *value;
+        });
+    }
+    std::vector<std::thread> producers;
+    for (std::uint64_t p = 0; p < 3; ++p) {
+        producers.emplace_back([&, p]() {
+            for (std::uint64_t i = 0; i < 10000; ++i) {
+                queue.push(p * 10000 + i);
+            }
+        });
+    }
+    for (auto& producer : producers) producer.join();
+    queue.close();
+    for (auto& consumer : consumers) consumer.join();
+    CHECK(total == 28 + 29999u * 30000 / 2);
+}
+
+TEST_CASE("BoundedQueue sleeps while there is nothing to do") {
+    StrongIndex::BoundedQueue<int> queue(2);
+    std::vector<int> popped;
+    std::thread consumer([&]() {
+        while (auto value = queue.pop()) popped.push_back(*value);
+    });
+    std::thread producer([&]() {
+        for (int i = 0; i < 4; ++i) queue.push(i);
+    });
+
+    // Once the values are through, the consumer sleeps on the empty queue
+    // instead of spinning.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    const std::clock_t start = std::clock();
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    CHECK(double(std::clock() - start) / CLOCKS_PER_SEC < 0.1);
+
+    producer.join();
+    queue.close();
+    consumer.join();
+    CHECK(popped == std::vector<int>{0, 1, 2, 3});
+}
+
+namespace {
+
+struct ExternalIdTag {};
+using ExternalId = StrongIndex::Basic<ExternalIdTag, std::uint64_t>;
+
+} // namespace
+
+TEST_CASE("Pipeline stages pass typed batches along") {
+    std::map<std::uint64_t, Basic> directory;
+    for (std::uint64_t i = 0; i < 100; ++i) {
+        directory.emplace(1000 + i, Basic(i));
+    }
+
+    std::mutex appendMutex;
+    std::vector<Basic> appended;
+    auto ingest = StrongIndex::PipelineBuilder<std::vector<std::string>>(4)
+            .then("parse", 2, [](std::vector<std::string> lines) {
+                std::vector<ExternalId> ids;
+                for (const auto& line : lines) {
+                    ids.emplace_back(std::stoull(line));
+                }
+                return ids;
+            })
+            .then("translate", 2, [&](std::vector<ExternalId> ids) {
+                std::vector<Basic> users;
+                for (ExternalId id : ids) {
+                    const auto external = static_cast<std::uint64_t>(id);
+                    auto found = directory.find(external);
+                    if (found == directory.end()) {
+                        throw std::out_of_range("Unknown ID");
+                    }
+                    users.push_back(found->second);
+                }
+                return users;
+            })
+            .into("append", 1, [&](std::vector<Basic> users) {
+                std::lock_guard<std::mutex> lock(appendMutex);
+                appended.insert(appended.end(), users.begin(), users.end());
+            });
+
+    for (int batch = 0; batch < 50; ++batch) {
+        ingest.push({std::to_string(1000 + batch * 2),
+                     std::to_string(1001 + batch * 2)});
+    }
+    ingest.push({"5"});
+    CHECK_THROWS_AS(ingest.finish(), std::out_of_range);
+
+    std::vector<bool> seen(100);
+    for (Basic user : appended) seen[static_cast<Underlying>(user)] = true;
+    CHECK(appended.size() == 100);
+    CHECK(std::count(seen.begin(), seen.end(), true) == 100);
+
+    auto metrics = ingest.metrics();
+    REQUIRE(metrics.size() == 3);
+    CHECK(metrics[0].name == "parse");
+    CHECK(metrics[0].threads == 2);
+    CHECK(metrics[0].items == 51);
+    CHECK(metrics[1].items == 51);
+    CHECK(metrics[2].items == 50);
+    CHECK(metrics[2].blocked.count() == 0);
+}
+
+TEST_CASE("TaskGraph runs tasks after their prerequisites") {
+    using StrongIndex::TaskId;
+    StrongIndex::TaskGraph graph;
+    std::atomic<int> step{0};
+    std::vector<int> finishedAt(203, -1);
+    auto task = [&](std::size_t slot) {
+        return [&, slot]() { finishedAt[slot] = step++; };
+    };
+
+    // load -> 200 independent transforms -> merge -> report
+    TaskId load = graph.add(task(0));
+    std::vector<TaskId> transforms;
+    for (std::size_t i = 0; i < 200; ++i) {
+        transforms.push_back(graph.add(task(1 + i), {load}));
+    }
+    TaskId merge = graph.add(task(201));
+    for (TaskId transform : transforms) graph.add_dependency(merge, transform);
+    TaskId report = graph.add(task(202), {merge});
+    CHECK(graph.size() == 203);
+    CHECK(graph.dependents(load).size() == 200);
+    CHECK(graph.dependents(merge).size() == 1);
+    CHECK(graph.dependents(merge)[0] == report);
+
+    graph.run(4);
+    CHECK(step == 203);
+    CHECK(finishedAt[0] == 0);
+    CHECK(finishedAt[201] == 201);
+    CHECK(finishedAt[202] == 202);
+
+    // Graphs can be run again.
+    step = 0;
+    graph.run(1);
+    CHECK(step == 203);
+
+    StrongIndex::TaskGraph failing;
+    TaskId first = failing.add([]() { throw std::runtime_error("failed"); });
+    bool ranAfter = false;
+    failing.add([&]() { ranAfter = true; }, {first});
+    CHECK_THROWS_AS(failing.run(2), std::runtime_error);
+    CHECK(!ranAfter);
+
+    StrongIndex::TaskGraph cyclic;
+    TaskId a = cyclic.add([]() {});
+    TaskId b = cyclic.add([]() {}, {a});
+    cyclic.add_dependency(a, b);
+    CHECK_THROWS_AS(cyclic.run(), std::invalid_argument);
+    CHECK_THROWS_AS(cyclic.add_dependency(a, TaskId(5)), std::invalid_argument);
+
+    // A bad prerequisite leaves the graph as it was.
+    CHECK_THROWS_AS(graph.add(task(0), {load, TaskId(500)}),
+                    std::invalid_argument);
+    CHECK(graph.size() == 203);
+    CHECK(graph.dependents(load).size() == 200);
+
+    // Threads with nothing to do sleep rather than spin.
+    StrongIndex::TaskGraph slow;
+    slow.add([]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    });
+    const std::clock_t start = std::clock();
+    slow.run(4);
+    CHECK(double(std::clock() - start) / CLOCKS_PER_SEC < 0.1);
+}
+
+TEST_CASE("Interleaved lookups find the same values as sequential ones") {
+    std::mt19937_64 random(7);
+    StrongIndex::IndexedVector<Basic, std::uint64_t> vector;
+    StrongIndex::FlatMap<Basic, std::uint64_t> map;
+    StrongIndex::BPlusTree<Basic, std::uint64_t, 128> tree;
+    for (Underlying i = 0; i < 5000; ++i) {
+        vector.push_back(i * 3);
+        if (i % 3 != 0) {
+            map.insert_or_assign(Basic(i), i * 3);
+            tree.insert_or_assign(Basic(i), i * 3);
+        }
+    }
+
+    std::vector<Basic> keys;
+    for (int i = 0; i < 1000; ++i) keys.emplace_back(random() % 5100);
+    std::span<const Basic> keySpan(keys);
+    std::vector<const std::uint64_t*> fromVector(keys.size());
+    std::vector<const std::uint64_t*> fromMap(keys.size());
+    std::vector<const std::uint64_t*> fromTree(keys.size());
+    StrongIndex::interleaved_find(vector, keySpan,
+                                  std::span<const std::uint64_t*>(fromVector));
+    StrongIndex::interleaved_find(map, keySpan,
+                                  std::span<const std::uint64_t*>(fromMap), 8);
+    StrongIndex::interleaved_find(tree, keySpan,
+                                  std::span<const std::uint64_t*>(fromTree), 1);
+
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+        const auto key = static_cast<Underlying>(keys[i]);
+        if (key < 5000) {
+            REQUIRE(fromVector[i] != nullptr);
+            CHECK(*fromVector[i] == key * 3);
+        } else {
+            CHECK(fromVector[i] == nullptr);
+        }
+        CHECK(fromMap[i] == map.find(keys[i]));
+        CHECK(fromTree[i] == tree.find(keys[i]));
+    }
+
+    StrongIndex::FlatMap<Basic, std::uint64_t> empty;
+    StrongIndex::interleaved_find(empty, keySpan,
+                                  std::span<const std::uint64_t*>(fromMap));
+    CHECK(std::count(fromMap.begin(), fromMap.end(), nullptr) == 1000);
+
+    // A lookup held by a thread_local may outlive its thread's frame cache.
+    std::thread([&vector] {
+        thread_local std::optional<StrongIndex::Lookup<const std::uint64_t*>>
+                held;
+        held.emplace(StrongIndex::lookup_in(vector, Basic(7)));
+        held->resume();
+        held->resume();
+        CHECK(*held->result() == 21);
+    }).join();
+}
+
+TEST_CASE("TimerWheel expires timers in deadline order") {
+    // Two levels only span 4096 ticks, so far deadlines overflow.
+    StrongIndex::TimerWheel<Basic, 2> timers(1000);
+    CHECK(timers.span == 4096);
+    std::map<Underlying, std::uint64_t> expected;
+    std::mt19937_64 random(11);
+    std::uint64_t now = 1000;
+    std::vector<Basic> expired;
+    for (int round = 0; round < 2000; ++round) {
+        const Underlying user = random() % 300;
+        const std::uint64_t roll = random() % 10;
+        if (roll < 6) {
+            const std::uint64_t deadline = now + random() % (roll < 5 ? 200
+                                                                      : 20000);
+            timers.schedule(Basic(user), deadline);
+            expected[user] = deadline;
+        } else if (roll < 8) {
+            CHECK(timers.cancel(Basic(user)) == (expected.erase(user) == 1));
+        } else {
+            now += random() % 300;
+            expired.clear();
+            timers.advance(now, expired);
+            std::uint64_t last = 0;
+            for (Basic index : expired) {
+                const auto user = static_cast<Underlying>(index);
+                const auto found = expected.find(user);
+                REQUIRE(found != expected.end());
+                CHECK(found->second <= now);
+                CHECK(found->second >= last);
+                last = found->second;
+                expected.erase(found);
+            }
+            for (const auto& [user, deadline] : expected) {
+                CHECK(deadline > now);
+            }
+        }
+        CHECK(timers.size() == expected.size());
+    }
+    for (const auto& [user, deadline] : expected) {
+        CHECK(timers.deadline(Basic(user)) == deadline);
+    }
+
+    // Past deadlines expire on the next tick, and callbacks may reschedule.
+    timers.schedule(Basic(500), 0);
+    std::vector<Basic> fired;
+    timers.advance(now + 1, [&](Basic index) {
+        fired.push_back(index);
+        timers.schedule(index, now + 50000);
+    });
+    CHECK(std::find(fired.begin(), fired.end(), Basic(500)) != fired.end());
+    CHECK(timers.is_scheduled(Basic(500)));
+    CHECK(!timers.is_scheduled(Basic(501)));
+    timers.advance(now + 49999, expired);
+    CHECK(timers.is_scheduled(Basic(500)));
+    expired.clear();
+    timers.advance(now + 50000, expired);
+    CHECK(std::find(expired.begin(), expired.end(), Basic(500))
+          != expired.end());
+}
+
+TEST_CASE("TimerWheel jumps over empty laps") {
+    StrongIndex::TimerWheel<Basic> timers;
+    const std::uint64_t far = std::uint64_t(1) << 36;
+    timers.schedule(Basic(1), far + 5);
+    timers.schedule(Basic(2), far);
+    timers.schedule(Basic(3), 3 * timers.span + 100);
+    timers.schedule(Basic(4), 200000);
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<Basic> expired;
+    CHECK(timers.advance(far - 1, expired) == 2);
+    CHECK(expired == std::vector<Basic>{Basic(4), Basic(3)});
+    CHECK(timers.advance(far + 4, expired) == 1);
+    CHECK(expired.back() == Basic(2));
+    CHECK(timers.advance(~std::uint64_t(0), expired) == 1);
+    CHECK(expired.back() == Basic(1));
+    CHECK(timers.empty());
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(1));
+}
+
+TEST_CASE("RollingWindows keeps the last events for each index") {
+    using Windows = StrongIndex::RollingWindows<Basic, int>;
+    Windows windows(10, 3);
+    CHECK(windows.capacity() == 4);
+    CHECK(windows.count(Basic(2)) == 0);
+    CHECK(!windows.window_min(Basic(2), 4));
+    CHECK(windows.window_sum(Basic(2), 4) == 0);
+
+    for (int i = 1; i <= 6; ++i) windows.push(Basic(2), 100 + i, i * 10);
+    CHECK(windows.count(Basic(2)) == 4);
+    CHECK(windows.at(Basic(2), 0) == std::pair<std::uint64_t, int>(106, 60));
+    CHECK(windows.at(Basic(2), 3) == std::pair<std::uint64_t, int>(103, 30));
+    CHECK(windows.window_sum(Basic(2), 2) == 110);
+    CHECK(windows.window_sum(Basic(2), 100) == 180);
+    CHECK(windows.window_min(Basic(2), 3) == 40);
+    CHECK(windows.window_max(Basic(2), 4) == 60);
+    std::vector<std::uint64_t> times;
+    windows.for_each(Basic(2), [&](std::uint64_t time, int) {
+        times.push_back(time);
+    });
+    CHECK(times == std::vector<std::uint64_t>{103, 104, 105, 106});
+
+    // Batches come in any order, and only the newest events are kept.
+    std::vector<Windows::Event> batch;
+    for (int i = 0; i < 40; ++i) {
+        batch.push_back({Basic(static_cast<Underlying>(i % 5)),
+                         static_cast<std::uint64_t>(1000 - i), i});
+    }
+    windows.append(batch);
+    CHECK(windows.count(Basic(0)) == 4);
+    CHECK(windows.at(Basic(0), 0).second == 0);
+    CHECK(windows.at(Basic(0), 3).second == 15);
+    CHECK(windows.count(Basic(2)) == 4);
+    CHECK(windows.at(Basic(2), 0) == std::pair<std::uint64_t, int>(998, 2));
+    CHECK(windows.count(Basic(7)) == 0);
+
+    // A small batch against many indices takes the comparison sort path.
+    Windows many(1000, 8);
+    std::vector<Windows::Event> few{{Basic(900), 5, 1}, {Basic(3), 2, 2},
+                                    {Basic(900), 4, 3}};
+    many.append(few);
+    CHECK(many.window_sum(Basic(900), 8) == 4);
+    CHECK(many.at(Basic(900), 0).second == 1);
+    CHECK(many.window_max(Basic(3), 1) == 2);
+
+    windows.clear(Basic(0));
+    CHECK(windows.count(Basic(0)) == 0);
+}
+
+namespace {
+
+// A value whose copies throw while armed, for checking that a failed append
+// leaves a column as it was.
+struct Fragile {
+    static inline bool armed = false;
+    int value = 0;
+
+    Fragile() = default;
+    Fragile(int value): value(value) {}
+    Fragile(const Fragile& other): value(other.value) { check(); }
+    Fragile& operator=(const Fragile& other) {
+        check();
+        value = other.value;
+        return *this;
+    }
+
+    static void check() {
+        if (armed) throw std::runtime_error("Fragile copy");
+    }
+
+    friend bool operator<(const Fragile& a, const Fragile& b) noexcept {
+        return a.value < b.value;
+    }
+};
+
+} // namespace
+
+TEST_CASE("ZonedColumn skips blocks using per-block statistics") {
+    // Timestamps which mostly go up, with some nulls and one late outlier.
+    StrongIndex::ZonedColumn<Incrementable, std::int64_t, 100> times;
+    for (std::int64_t i = 0; i < 1000; ++i) {
+        if (i % 50 == 7) {
+            times.push_null();
+        } else {
+            times.push_back(i == 950 ? 5 : i * 10 + i % 3);
+        }
+    }
+    CHECK(times.size() == 1000);
+    CHECK(times.block_count() == 10);
+    CHECK(times.block_stats(0).min == 0);
+    CHECK(times.block_stats(0).max == 99 * 10);
+    CHECK(times.block_stats(0).nullCount == 2);
+    CHECK(times.block_stats(9).min == 5);
+    CHECK(times.is_null(Incrementable(57)));
+    CHECK(times[Incrementable(58)] == 581);
+
+    auto ranges = times.candidates(2000, 3500);
+    REQUIRE(ranges.size() == 2);
+    CHECK(ranges[0] == StrongIndex::IndexRange<Incrementable>(
+                               Incrementable(200), Incrementable(400)));
+    CHECK(ranges[1].first() == Incrementable(900));
+    CHECK(ranges[1].last() == Incrementable(1000));
+    CHECK(times.candidates(100000, 200000).empty());
+
+    std::size_t scanned = 0;
+    times.scan_between(2000, 3500, [&](Incrementable index, std::int64_t t) {
+        CHECK(!times.is_null(index));
+        CHECK(t >= 2000);
+        CHECK(t <= 3500);
+        ++scanned;
+    });
+    std::size_t expected = 0;
+    for (Underlying i = 0; i < 1000; ++i) {
+        const Incrementable index(i);
+        expected += !times.is_null(index) && times[index] >= 2000
+                    && times[index] <= 3500;
+    }
+    CHECK(scanned == expected);
+    CHECK(times.count_between(2000, 3500) == expected);
+    CHECK(times.count_between(0, 100000) == 980);
+
+    auto nullBlocks = times.candidates_if([](const auto& stats) {
+        return stats.nullCount > 0;
+    });
+    CHECK(nullBlocks.size() == 1);
+    CHECK(nullBlocks[0].size() == 1000);
+
+    // An append which throws leaves neither stats nor validity behind.
+    StrongIndex::ZonedColumn<Basic, Fragile, 8> fragile;
+    for (int i = 0; i < 4; ++i) fragile.push_back(Fragile(i));
+    Fragile::armed = true;
+    CHECK_THROWS_AS(fragile.push_back(Fragile(2)), std::runtime_error);
+    CHECK_THROWS_AS(fragile.push_back(Fragile(100)), std::runtime_error);
+    CHECK_THROWS_AS(fragile.push_null(), std::runtime_error);
+    Fragile::armed = false;
+    CHECK(fragile.size() == 4);
+    CHECK(fragile.validity().size() == 4);
+    CHECK(fragile.block_stats(0).valueCount == 4);
+    CHECK(fragile.block_stats(0).nullCount == 0);
+    CHECK(fragile.block_stats(0).max.value == 3);
+    CHECK(fragile.count_between(Fragile(0), Fragile(10)) == 4);
+}
+
+TEST_CASE("DictionaryColumn encodes values as typed codes") {
+    using Countries = StrongIndex::DictionaryColumn<Basic, struct CountryTag>;
+    using Devices = StrongIndex::Dictionary<struct DeviceTag>;
+    static_assert(!std::is_convertible_v<Countries::Code, Devices::Code>);
+
+    Countries countries;
+    const std::vector<std::string> names{"DE", "FR", "US", "JP", "BR"};
+    for (Underlying i = 0; i < 1000; ++i) {
+        countries.push_back(names[i * i % names.size()]);
+    }
+    CHECK(countries.size() == 1000);
+    CHECK(countries.dictionary().size() == 3);
+    CHECK(countries.bits() == 2);
+    CHECK(countries.bytes() == 250);
+    CHECK(countries[Basic(2)] == "BR");
+    CHECK(countries.code(Basic(0)) == Countries::Code(0));
+    CHECK(countries.dictionary().find("US") == std::nullopt);
+
+    auto french = countries.where_equal("FR");
+    CHECK(french.count() == 400);
+    CHECK(french.test(Basic(1)));
+    CHECK(!french.test(Basic(2)));
+    CHECK(countries.where_equal("US").count() == 0);
+
+    std::size_t predicateCalls = 0;
+    auto european = countries.where([&](const std::string& name) {
+        ++predicateCalls;
+        return name == "DE" || name == "FR";
+    });
+    CHECK(predicateCalls == 3);
+    CHECK(european.count() == 600);
+
+    // Growing the dictionary widens the codes without changing them.
+    for (int i = 0; i < 100; ++i) {
+        countries.push_back("X" + std::to_string(i));
+    }
+    CHECK(countries.bits() == 7);
+    CHECK(countries[Basic(2)] == "BR");
+    CHECK(countries[Basic(1050)] == "X50");
+    CHECK(countries.where_equal("FR").count() == 400);
+}
+
+TEST_CASE("NullableColumn keeps nulls in a separate bitmap") {
+    StrongIndex::NullableColumn<Basic, double> prices;
+    static_assert(sizeof(double) < sizeof(std::optional<double>));
+    for (Underlying i = 0; i < 192; ++i) {
+        if (i % 7 == 3) {
+            prices.push_null();
+        } else {
+            prices.push_back(double(i));
+        }
+    }
+    // A whole word of nulls, then a partial word with no nulls.
+    for (int i = 0; i < 64; ++i) prices.push_back(std::optional<double>());
+    prices.push_back(-5.0);
+    prices.push_back(1000.0);
+
+    CHECK(prices.size() == 258);
+    CHECK(prices.null_count() == 27 + 64);
+    CHECK(prices.count() == 167);
+    CHECK(prices.is_null(Basic(3)));
+    CHECK(prices.get(Basic(3)) == std::nullopt);
+    CHECK(prices[Basic(3)] == 0.0);
+    CHECK(prices.get(Basic(4)) == 4.0);
+
+    double visited = 0.0;
+    prices.for_each_valid([&](Basic index, double value) {
+        CHECK(!prices.is_null(index));
+        visited += value;
+    });
+    CHECK(visited == 15798.0 + 995.0);
+    CHECK(prices.sum() == 15798.0 + 995.0);
+    CHECK(prices.min() == -5.0);
+    CHECK(prices.max() == 1000.0);
+
+    prices.set_null(Basic(257));
+    prices.set(Basic(3), 2000.0);
+    CHECK(prices.max() == 2000.0);
+    CHECK(prices.null_count() == 27 + 64);
+
+    // The buffers are the column's own storage.
+    CHECK(prices.values().data() == &prices[Basic(0)]);
+    CHECK(prices.values()[257] == 0.0);
+    CHECK(prices.validity_words().size() == 5);
+    CHECK(prices.validity_words()[3] == 0);
+    CHECK(prices.validity_words()[4] == 0b01);
+
+    StrongIndex::NullableColumn<Basic, int> empty(10);
+    CHECK(empty.null_count() == 10);
+    CHECK(empty.sum() == 0);
+    CHECK(empty.min() == std::nullopt);
+
+    // An append which throws leaves no validity bit behind.
+    StrongIndex::NullableColumn<Basic, Fragile> fragile;
+    fragile.reserve(64);
+    for (int i = 0; i < 64; ++i) fragile.push_back(Fragile(i));
+    Fragile::armed = true;
+    CHECK_THROWS_AS(fragile.push_back(Fragile(64)), std::runtime_error);
+    CHECK_THROWS_AS(fragile.push_null(), std::runtime_error);
+    Fragile::armed = false;
+    CHECK(fragile.size() == 64);
+    CHECK(fragile.validity().size() == 64);
+    CHECK(fragile.validity_words().size() == 1);
+    CHECK(fragile.max()->value == 63);
+    fragile.push_null();
+    CHECK(fragile.null_count() == 1);
+    CHECK(fragile.is_null(Basic(64)));
+}
+
+TEST_CASE("Arrow files round-trip index-keyed tables") {
+    using Row = StrongIndex::Incrementable<struct RowTag, std::uint32_t>;
+    using UserId = StrongIndex::Basic<struct UserIdTag, std::uint64_t>;
+
+    StrongIndex::IndexedVector<Row, double> prices;
+    StrongIndex::IndexedVector<Row, UserId> users;
+    StrongIndex::IndexedVector<Row, std::string> names;
+    StrongIndex::NullableColumn<Row, std::int16_t> ratings;
+    for (std::uint32_t i = 0; i < 100; ++i) {
+        prices.push_back(i * 1.5);
+        users.push_back(UserId(1000 + i * i));
+        names.push_back(i % 10 == 0 ? "" : "user" + std::to_string(i));
+        if (i % 3 == 0) {
+            ratings.push_null();
+        } else {
+            ratings.push_back(static_cast<std::int16_t>(i - 50));
+        }
+    }
+
+    StrongIndex::ArrowWriter<Row> writer;
+    writer.add("price", prices)
+          .add("user", users, "UserId")
+          .add("name", names)
+          .add("rating", ratings);
+    const StrongIndex::IndexedVector<Row, int> shortColumn(10);
+    CHECK_THROWS_AS(writer.add("short", shortColumn), std::invalid_argument);
+    std::ostringstream out;
+    writer.write(out);
+    const std::string text = out.str();
+    const std::vector<std::uint8_t> file(text.begin(), text.end());
+
+    // Writers move, keeping their string buffers, but don't copy.
+    static_assert(!std::is_copy_constructible_v<StrongIndex::ArrowWriter<Row>>);
+    StrongIndex::ArrowWriter<Row> moved = std::move(writer);
+    std::ostringstream movedOut;
+    moved.write(movedOut);
+    CHECK(movedOut.str() == text);
+
+    CHECK(text.substr(0, 6) == "ARROW1");
+    CHECK(text.substr(text.size() - 6) == "ARROW1");
+
+    const StrongIndex::ArrowReader reader(file);
+    CHECK(reader.rows() == 100);
+    CHECK(reader.batch_count() == 1);
+    REQUIRE(reader.fields().size() == 4);
+    CHECK(reader.fields()[1].name == "user");
+    CHECK(reader.field("user").type
+          == StrongIndex::ArrowType{StrongIndex::ArrowKind::Int, 64, false});
+    CHECK(reader.field("user").find_metadata(StrongIndex::arrowTagKey)
+          == "UserId");
+    CHECK(reader.field("rating").nullable);
+    CHECK(!reader.field("price").nullable);
+    CHECK(reader.null_count("rating") == 34);
+
+    // Numeric buffers are read in place.
+    std::span<const double> priceView = reader.values<double>("price");
+    CHECK(priceView.size() == 100);
+    CHECK(priceView[99] == 148.5);
+    CHECK(static_cast<const void*>(priceView.data())
+          > static_cast<const void*>(file.data()));
+    CHECK(reader.validity("price").empty());
+    CHECK(reader.validity("rating").size() >= 13);
+    CHECK(reader.values<std::uint64_t>("user")[7] == 1049);
+
+    auto prices2 = reader.column<Row, double>("price");
+    CHECK(prices2.storage() == prices.storage());
+    auto users2 = reader.index_column<Row, UserId>("user", "UserId");
+    REQUIRE(users2.size() == 100);
+    CHECK(users2[Row(12)] == UserId(1144));
+    auto names2 = reader.column<Row, std::string>("name");
+    CHECK(names2.storage() == names.storage());
+    auto ratings2 = reader.nullable_column<Row, std::int16_t>("rating");
+    CHECK(ratings2.null_count() == 34);
+    CHECK(ratings2.is_null(Row(3)));
+    CHECK(ratings2.get(Row(4)) == -46);
+    CHECK(ratings2.sum() == ratings.sum());
+
+    // Strong typing survives the round trip.
+    CHECK_THROWS_AS((reader.index_column<Row, UserId>("user", "OrderId")),
+                    std::invalid_argument);
+    CHECK_THROWS_AS(reader.values<float>("price"), std::invalid_argument);
+    CHECK_THROWS_AS((reader.column<Row, std::int16_t>("rating")),
+                    std::invalid_argument);
+    CHECK_THROWS_AS(reader.field("missing"), std::invalid_argument);
+
+    std::vector<std::uint8_t> truncated(file.begin(), file.end() - 20);
+    CHECK_THROWS_AS(StrongIndex::ArrowReader{truncated}, std::runtime_error);
+}